@@ -0,0 +1,124 @@
+module cli.batchapp;
+
+import log;
+import stormkit.core;
+import utils;
+import pugixml;
+
+import engine.model;
+import parser;
+import parser.binary;
+import config;
+import pool;
+import cli.headlessapp;
+
+namespace stk  = stormkit;
+namespace stdr = std::ranges;
+namespace stdv = std::views;
+
+using namespace std::string_literals;
+using clk = std::chrono::steady_clock;
+
+static const auto DEFAULT_OUTPUT_DIR = "output"s;
+
+/** A line of the jobs file, a model file followed by its own arguments (`--seed`, `--count`, `--size`, ...) */
+struct Job {
+  Config   config;
+  stk::u64 seed;
+  stk::u64 count;
+};
+
+static auto parse_jobs(const std::filesystem::path& path) noexcept -> std::vector<Job> {
+  auto in = std::ifstream{ path };
+  stk::ensures(static_cast<bool>(in), std::format("can't open jobs file {}", path.string()));
+
+  auto jobs = std::vector<Job>{};
+  for (auto line = std::string{}; std::getline(in, line);) {
+    if (stdr::empty(line) or line.starts_with('#')) continue;
+
+    auto tokens = line
+      | stdv::split(' ')
+      | stdv::filter(std::not_fn(stdr::empty))
+      | stdv::transform([](auto&& token) static noexcept {
+          return std::string_view{ stdr::begin(token), stdr::end(token) };
+      })
+      | stdr::to<std::vector>();
+
+    jobs.emplace_back(
+      Config::parse(tokens),
+      option(tokens, "seed").transform(std::bind_back(fromBase<stk::u64>, 10)).value_or(0),
+      option(tokens, "count").transform(std::bind_back(fromBase<stk::u64>, 10)).value_or(1)
+    );
+  }
+
+  return jobs;
+}
+
+auto BatchApp::operator()(std::span<const std::string_view> args) noexcept -> int {
+  auto jobsfile = option(args, "batch");
+  stk::ensures(jobsfile.has_value(), "missing --batch=<jobs file>");
+
+  auto outputdir = std::filesystem::path{ option(args, "output").value_or(DEFAULT_OUTPUT_DIR) };
+  auto error = std::error_code{};
+  std::filesystem::create_directories(outputdir, error);
+  stk::ensures(not error, std::format("can't create {}: {}", outputdir.string(), error.message()));
+
+  auto jobs = parse_jobs(*jobsfile);
+
+  // each model file is compiled once, its instances then share it read only
+  auto compiled = flag(args, "compiled");
+  auto models   = std::unordered_map<std::filesystem::path, std::shared_ptr<const CompiledModel>>{};
+  for (const auto& job : jobs) {
+    const auto& file = job.config.modelfile;
+    if (models.contains(file)) continue;
+
+    models.emplace(file, std::make_shared<const CompiledModel>(
+      compiled ? parser::binary::load(file)
+               : parser::Model(parser::document(file))
+    ));
+  }
+
+  auto threads = option(args, "threads")
+    .transform(std::bind_back(fromBase<std::size_t>, 10))
+    .value_or(std::max(1u, std::thread::hardware_concurrency()));
+  stk::ensures(threads > 0, "--threads must be at least 1");
+  auto pool = Pool{ threads };
+
+  auto instances = std::atomic<stk::u64>{ 0 };
+  auto steps     = std::atomic<stk::u64>{ 0 };
+  auto failures  = std::atomic<stk::u64>{ 0 };
+
+  auto start = clk::now();
+  for (const auto& job : jobs) {
+    const auto& compiled_model = models.at(job.config.modelfile);
+    for (auto seed : stdv::iota(job.seed, job.seed + job.count)) {
+      pool.submit([&job, &compiled_model, &outputdir, &instances, &steps, &failures, seed] noexcept {
+        // each instance owns its grid and runtime state
+        auto model = ModelInstance{ compiled_model };
+        model.program.seed(seed);
+        auto grid  = model.grid(job.config.extents);
+
+        auto execution = Execution{ .limit = job.config.steps };
+        steps += run(model, grid, execution);
+
+        auto outputfile = outputdir / std::format("{}_{}.txt", job.config.modelfile.stem().string(), seed);
+        if (not save(grid, outputfile)) ++failures;
+        ++instances;
+      });
+    }
+  }
+  pool.wait();
+  auto elapsed = std::chrono::duration<double>{ clk::now() - start };
+
+  std::println("{} instances of {} jobs, {} steps in {:.3f}s on {} threads ({:.0f} steps/s)",
+    instances.load(), stdr::size(jobs), steps.load(), elapsed.count(), pool.size(),
+    elapsed.count() > 0.0 ? static_cast<double>(steps.load()) / elapsed.count() : 0.0
+  );
+
+  if (failures > 0) {
+    std::println(std::cerr, "{} instances couldn't be written to {}", failures.load(), outputdir.string());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,116 @@
+module cli.headlessapp;
+
+import log;
+import stormkit.core;
+import utils;
+
+import engine.model;
+import engine.rulenode;
+import parser;
+import parser.binary;
+import config;
+
+namespace stk  = stormkit;
+namespace stdr = std::ranges;
+namespace stdv = std::views;
+
+using namespace std::string_literals;
+using clk = std::chrono::steady_clock;
+
+static const auto DEFAULT_OUTPUT_FILE = "output.txt"s;
+
+static auto profile(const ProgramState& state) noexcept -> void {
+  const auto& program = *state.program;
+  std::println("{:<24} {:>12} {:>12} {:>12}", "node", "invocations", "steps", "time (ms)");
+  for (auto&& [i, node] : stdv::enumerate(program.nodes)) {
+    auto kind = node.kind == Program::Node::Kind::MARKOV   ? "markov"
+              : node.kind == Program::Node::Kind::SEQUENCE ? "sequence"
+              : program.rules[node.rule].mode == RuleNode::Mode::ONE ? "one"
+              : program.rules[node.rule].mode == RuleNode::Mode::ALL ? "all"
+                                                                     : "prl";
+    auto name = std::format("{:{}}{} #{}", "", 2 * program.depth(static_cast<std::size_t>(i)), kind, i);
+    if (node.kind != Program::Node::Kind::RULE) {
+      std::println("{:<24}", name);
+      continue;
+    }
+    const auto& counters = state.nodes[static_cast<std::size_t>(i)].counters;
+    std::println("{:<24} {:>12} {:>12} {:>12.3f}",
+      name, counters.invocations, counters.steps,
+      std::chrono::duration<double, std::milli>{ counters.time }.count()
+    );
+  }
+}
+
+auto HeadlessApp::operator()(std::span<const std::string_view> args) noexcept -> int {
+  auto config = Config::parse(args);
+  auto outputfile = std::string{ option(args, "output").value_or(DEFAULT_OUTPUT_FILE) };
+
+  // the compiled model skips xml parsing and symmetry expansion
+  auto model = ModelInstance{ std::make_shared<const CompiledModel>(
+    flag(args, "compiled") ? parser::binary::load(config.modelfile)
+                           : parser::Model(parser::document(config.modelfile))
+  ) };
+
+  auto seed = config.seed.value_or(std::random_device{}());
+  model.program.seed(seed);
+  auto grid = model.grid(config.extents);
+
+  auto execution = Execution{ .limit = config.steps };
+  if (auto interval = option(args, "checkpoint"); interval) {
+    execution.interval   = fromBase<stk::u64>(*interval, 10);
+    execution.checkpoint = [](const TracedGrid<char>&, stk::u64 steps) static noexcept {
+      std::println(std::cerr, "{} steps", steps);
+      return true;
+    };
+  }
+
+  model.program.profiling = flag(args, "profile");
+
+  auto start = clk::now();
+  auto steps = run(model, grid, execution);
+  auto elapsed = std::chrono::duration<double>{ clk::now() - start };
+
+  if (model.program.profiling) {
+    profile(model.program);
+  }
+
+  std::println("{} (seed {}): {} steps in {:.3f}s ({:.0f} steps/s)",
+    config.modelfile.string(), seed, steps, elapsed.count(),
+    elapsed.count() > 0.0 ? static_cast<double>(steps) / elapsed.count() : 0.0
+  );
+
+  if (not save(grid, outputfile)) {
+    std::println(std::cerr, "can't write {}", outputfile);
+    return 1;
+  }
+
+  return 0;
+}
+
+auto run(ModelInstance& model, TracedGrid<char>& grid, Execution& execution) noexcept -> stk::u64 {
+  // the step cap or the checkpoint may stop it first
+  model.halted = model.program.run(grid, execution);
+
+  return execution.steps;
+}
+
+auto save(const Grid<char>& grid, const std::filesystem::path& path) noexcept -> bool {
+  auto out = std::ofstream{ path, std::ios::trunc };
+  if (not out) {
+    elog("can't open {}", path.string());
+    return false;
+  }
+
+  const auto depth  = grid.extents.extent(0);
+  const auto height = grid.extents.extent(1);
+  const auto width  = grid.extents.extent(2);
+  for (auto z = 0uz; z < depth; ++z) {
+    if (z > 0) out << '\n';
+    for (auto y = 0uz; y < height; ++y) {
+      out.write(stdr::data(grid.values) + (z * height + y) * width, static_cast<std::streamsize>(width));
+      out << '\n';
+    }
+  }
+
+  return static_cast<bool>(out);
+}
@@ -0,0 +1,80 @@
+module config;
+
+import log;
+import utils;
+import pugixml;
+import parser;
+
+namespace stk  = stormkit;
+namespace stdr = std::ranges;
+
+using namespace std::string_literals;
+
+auto option(std::span<const std::string_view> args, std::string_view name) noexcept -> std::optional<std::string_view> {
+  auto prefix = std::format("--{}=", name);
+  auto arg = stdr::find_if(args, [&prefix](auto arg) noexcept {
+    return arg.starts_with(prefix);
+  });
+  if (arg == stdr::end(args)) return std::nullopt;
+  return arg->substr(stdr::size(prefix));
+}
+
+auto flag(std::span<const std::string_view> args, std::string_view name) noexcept -> bool {
+  auto expected = std::format("--{}", name);
+  return stdr::find(args, expected) != stdr::end(args);
+}
+
+/** Unsigned attribute, overridden by the argument of the same name */
+static auto setting(
+  std::span<const std::string_view> args,
+  const pugi::xml_node& xentry,
+  std::string_view name,
+  stk::i64 fallback
+) noexcept -> stk::i64 {
+  if (auto arg = option(args, name); arg) {
+    return fromBase<stk::i64>(*arg, 10);
+  }
+  return xentry.attribute(std::string{ name }.c_str()).as_llong(fallback);
+}
+
+auto Config::parse(std::span<const std::string_view> args) noexcept -> Config {
+  auto config = Config{};
+
+  auto modelarg = stdr::find_if(args, [](const auto& arg) static noexcept {
+    return stdr::cbegin(stdr::search(arg, "models/"s)) == stdr::cbegin(arg);
+  });
+  if (modelarg != stdr::end(args)) config.modelfile = *modelarg;
+
+  // models.xml entries are named after the model file
+  auto name = config.modelfile.stem().string();
+  auto xmodels = parser::document(MODELS_FILE);
+  auto xentry = xmodels.child("models").find_child_by_attribute("model", "name", name.c_str());
+  if (not xentry) {
+    ilog("no entry for {} in {}, using defaults", name, MODELS_FILE);
+  }
+
+  auto d      = setting(args, xentry, "d", 2);
+  auto size   = setting(args, xentry, "size", DEFAULT_SIZE);
+  auto length = setting(args, xentry, "length", size);
+  auto width  = setting(args, xentry, "width", size);
+  auto height = setting(args, xentry, "height", d == 2 ? 1 : size);
+  auto steps  = setting(args, xentry, "steps", static_cast<stk::i64>(DEFAULT_STEPS));
+
+  stk::ensures(d == 2 or d == 3, std::format("dimension must be 2 or 3, got {}", d));
+  stk::ensures(
+    length > 0 and width > 0 and height > 0,
+    std::format("grid extents must be positive, got {}x{}x{}", length, width, height)
+  );
+
+  config.extents = {
+    static_cast<std::size_t>(height),
+    static_cast<std::size_t>(width),
+    static_cast<std::size_t>(length),
+  };
+  // negative steps run to halt
+  config.steps = steps < 0 ? 0 : static_cast<stk::u64>(steps);
+
+  config.seed = option(args, "seed").transform(std::bind_back(fromBase<stk::u64>, 10));
+
+  return config;
+}
@@ -10,6 +10,11 @@ void Controls::toggle_pause() {
   pause_cv.notify_one();
 }
 
+void Controls::pause() {
+  auto l = std::lock_guard{ pause_m };
+  model_paused = true;
+}
+
 void Controls::go_next() {
   next_frame = true;
   {
@@ -27,9 +32,10 @@ void Controls::reset() {
   pause_cv.notify_one();
 
   onReset();
+  generation.fetch_add(1);
 }
 
-void Controls::wait_unpause() {
+void Controls::wait_unpause(std::stop_token stop) {
   if (next_frame) {
     auto l = std::lock_guard{ pause_m };
     model_paused = true;
@@ -37,7 +43,7 @@ void Controls::wait_unpause() {
   }
   {
     auto l = std::unique_lock{ pause_m };
-    pause_cv.wait(l, [&paused = model_paused]{ return not paused; });
+    pause_cv.wait(l, stop, [&paused = model_paused]{ return not paused; });
   }
 }
 
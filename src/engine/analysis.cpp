@@ -0,0 +1,139 @@
+module engine.analysis;
+
+import stormkit.core;
+import utils;
+import log;
+
+import engine.rewriterule;
+import engine.rulenode;
+
+namespace stk  = stormkit;
+namespace stdr = std::ranges;
+namespace stdv = std::views;
+
+using Symbols = Accepted;
+
+static auto bit(char c) noexcept -> std::size_t {
+  return static_cast<unsigned char>(c);
+}
+
+/** Every input cell can read one of the symbols */
+static auto live(const RewriteRule& rule, const Symbols& symbols) noexcept -> bool {
+  return stdr::all_of(rule.input, [&symbols](const auto& input) noexcept {
+    return not input
+        or stdr::any_of(*input, [&symbols](auto c) noexcept { return symbols.test(bit(c)); });
+  });
+}
+
+/** Observe and search nodes weigh their matches with every rule, their rules must stay as parsed */
+static auto prunable(const RuleNode& node) noexcept -> bool {
+  return node.inference == RuleNode::Inference::RANDOM
+      or node.inference == RuleNode::Inference::DISTANCE;
+}
+
+/** Symbols each rule node can find in the grid, over every time it runs */
+struct Reached {
+  std::unordered_map<const RuleNode*, Symbols> nodes = {};
+
+  /** Symbols the node can leave in the grid when it starts with `symbols` */
+  auto flow(const NodeRunner& node, const Symbols& in) noexcept -> Symbols {
+    return node.visit(Visitor{
+      [this, &in](const RuleRunner& r) noexcept {
+        const auto& rulenode = r.rulenode;
+        auto symbols = in;
+        auto before = Symbols{};
+        do {
+          before = symbols;
+          for (const auto& rule : rulenode.rules) {
+            if (not live(rule, symbols)) continue;
+            for (const auto& o : rule.output) {
+              if (o) symbols.set(bit(*o));
+            }
+          }
+          // the observed cells are rewritten before the rules run
+          for (const auto& [c, observe] : rulenode.observes) {
+            if (observe.from and symbols.test(bit(c))) symbols.set(bit(*observe.from));
+          }
+        } while (before != symbols);
+        nodes[&rulenode] |= symbols;
+        return symbols;
+      },
+      [this, &in](const TreeRunner& t) noexcept {
+        auto symbols = in;
+        if (t.mode == TreeRunner::Mode::SEQUENCE) {
+          // a child never runs again once the next one started, unless the whole sequence does
+          for (const auto& child : t.nodes) symbols = flow(child, symbols);
+          return symbols;
+        }
+        // any child can run after any other
+        auto before = Symbols{};
+        do {
+          before = symbols;
+          for (const auto& child : t.nodes) symbols = flow(child, symbols);
+        } while (before != symbols);
+        return symbols;
+      },
+    });
+  }
+};
+
+struct Pruned {
+  std::size_t rules = 0;
+  std::size_t nodes = 0;
+};
+
+/** Whether the node is kept */
+static auto prune(NodeRunner& node, const Reached& reached, Pruned& pruned) noexcept -> bool {
+  return node.visit(Visitor{
+    [&reached, &pruned](RuleRunner& r) noexcept {
+      auto& rulenode = r.rulenode;
+      if (not prunable(rulenode)) return true;
+
+      // a node that never runs reaches nothing, all of its rules are dead
+      const auto symbols = reached.nodes.contains(&rulenode) ? reached.nodes.at(&rulenode) : Symbols{};
+
+      auto rules   = std::vector<RewriteRule>{};
+      auto origins = std::vector<stk::u16>{};
+      for (auto&& [rule, origin] : stdv::zip(rulenode.rules, rulenode.origins)) {
+        if (not live(rule, symbols)) continue;
+        rules.push_back(rule.narrowed(symbols));
+        origins.push_back(origin);
+      }
+      pruned.rules += stdr::size(rulenode.rules) - stdr::size(rules);
+      rulenode.retain(std::move(rules), std::move(origins));
+
+      // it would fail every time it runs, as if it wasn't there
+      return not stdr::empty(rulenode.rules);
+    },
+    [&reached, &pruned](TreeRunner& t) noexcept {
+      const auto before = stdr::size(t.nodes);
+      std::erase_if(t.nodes, [&reached, &pruned](auto& child) noexcept {
+        return not prune(child, reached, pruned);
+      });
+      pruned.nodes += before - stdr::size(t.nodes);
+
+      // an empty tree fails as soon as it's entered
+      return not stdr::empty(t.nodes);
+    },
+  });
+}
+
+namespace analysis {
+
+auto prune(NodeRunner& program, std::string_view initial) noexcept -> void {
+  auto symbols = Symbols{};
+  for (auto c : initial) symbols.set(bit(c));
+
+  auto reached = Reached{};
+  reached.flow(program, symbols);
+
+  // the root is kept whatever happens, it halts the program when empty
+  auto pruned = Pruned{};
+  ::prune(program, reached, pruned);
+
+  if (pruned.rules > 0 or pruned.nodes > 0) {
+    ilog("pruned {} dead rules and {} nodes", pruned.rules, pruned.nodes);
+  }
+}
+
+}
@@ -0,0 +1,273 @@
+module engine.cache;
+
+import log;
+
+namespace stk  = stormkit;
+namespace stdr = std::ranges;
+namespace stdv = std::views;
+
+static constexpr auto MAGIC   = std::array{ 'M', 'J', 'T', 'C' };
+static constexpr auto VERSION = stk::u32{ 1 };
+
+/** FNV-1a over 64 bits words */
+struct Fnv {
+  stk::u64 h = 14695981039346656037ull;
+
+  constexpr auto operator()(stk::u64 v) noexcept -> void {
+    h ^= v;
+    h *= 1099511628211ull;
+  }
+};
+
+template <class T>
+static auto mix(Fnv& fnv, const Grid<T>& grid, auto&& cell) noexcept -> void {
+  fnv(grid.extents.extent(0));
+  fnv(grid.extents.extent(1));
+  fnv(grid.extents.extent(2));
+  for (const auto& v : grid.values) fnv(cell(v));
+}
+
+/** Order independent, charsets are unordered */
+static auto mask(const std::unordered_set<char>& cs) noexcept -> stk::u64 {
+  auto m = stk::u64{ 0 };
+  for (auto c : cs) m ^= std::rotl(0x9e3779b97f4a7c15ull, static_cast<unsigned char>(c) % 64) + static_cast<unsigned char>(c);
+  return m;
+}
+
+auto TrajectoryCache::instance() noexcept -> TrajectoryCache& {
+  static auto cache = TrajectoryCache{};
+  return cache;
+}
+
+auto TrajectoryCache::key(
+  const Grid<char>& grid,
+  const Future& future,
+  std::span<const RewriteRule> rules,
+  bool all,
+  const Search& search
+) noexcept -> Key {
+  auto fnv = Fnv{};
+
+  mix(fnv, grid, [](char c) static noexcept -> stk::u64 { return static_cast<unsigned char>(c); });
+  mix(fnv, future, mask);
+
+  // the rules and the search settings identify the node
+  for (const auto& rule : rules) {
+    mix(fnv, rule.input, [](const auto& i) static noexcept -> stk::u64 {
+      return i.transform(mask).value_or(~stk::u64{ 0 });
+    });
+    mix(fnv, rule.output, [](const auto& o) static noexcept -> stk::u64 {
+      return o.transform([](char c) static noexcept -> stk::u64 { return static_cast<unsigned char>(c); })
+              .value_or(~stk::u64{ 0 });
+    });
+  }
+  fnv(all);
+  fnv(std::to_underlying(search.strategy));
+  fnv(search.limit);
+  fnv(search.width);
+  fnv(std::bit_cast<stk::u64>(search.depthCoefficient));
+  fnv(search.canonical);
+
+  return fnv.h;
+}
+
+static auto extents_of(const Grid<char>& grid) noexcept -> std::array<stk::u32, 3> {
+  return {
+    static_cast<stk::u32>(grid.extents.extent(0)),
+    static_cast<stk::u32>(grid.extents.extent(1)),
+    static_cast<stk::u32>(grid.extents.extent(2)),
+  };
+}
+
+auto TrajectoryCache::find(Key key, const Grid<char>& grid) noexcept -> std::optional<Trajectory> {
+  auto lock = std::scoped_lock{ mutex };
+
+  auto it = index.find(key);
+  if (it == stdr::end(index)
+   or it->second->extents != extents_of(grid)
+   or not stdr::equal(it->second->start, grid.values)
+  ) {
+    return std::nullopt;
+  }
+  entries.splice(stdr::begin(entries), entries, it->second);
+
+  auto trajectory = Trajectory{};
+  trajectory.reserve(stdr::size(it->second->steps));
+
+  auto state = Grid<char>{ grid };
+  for (const auto& step : it->second->steps) {
+    for (auto [i, value] : step) state.values[i] = value;
+    trajectory.push_back(auto{ state });
+  }
+
+  return trajectory;
+}
+
+auto TrajectoryCache::insert(Key key, const Grid<char>& grid, const Trajectory& trajectory) noexcept -> void {
+  auto entry = Entry{ key, extents_of(grid), grid.values, {} };
+  entry.steps.reserve(stdr::size(trajectory));
+
+  const auto* prev = &grid;
+  for (const auto& state : trajectory) {
+    auto& step = entry.steps.emplace_back();
+    for (auto i = 0u; i < stdr::size(state.values); ++i) {
+      if (state.values[i] != prev->values[i]) step.emplace_back(i, state.values[i]);
+    }
+    prev = &state;
+  }
+
+  auto lock = std::scoped_lock{ mutex };
+
+  if (auto it = index.find(key); it != stdr::end(index)) {
+    entries.erase(it->second);
+    index.erase(it);
+  }
+  entries.push_front(std::move(entry));
+  index.emplace(key, stdr::begin(entries));
+
+  evict();
+}
+
+auto TrajectoryCache::evict() noexcept -> void {
+  while (stdr::size(entries) > capacity) {
+    index.erase(entries.back().key);
+    entries.pop_back();
+  }
+}
+
+template <class T>
+static auto read(std::istream& in, T& v) noexcept -> bool {
+  return static_cast<bool>(in.read(reinterpret_cast<char*>(&v), sizeof(T)));
+}
+
+/** `n` items of `each` bytes can still be read, a larger count comes from a corrupt file */
+static auto fits(std::istream& in, std::uintmax_t size, stk::u64 n, std::size_t each) noexcept -> bool {
+  auto at = in.tellg();
+  if (at < 0 or static_cast<std::uintmax_t>(at) > size) return false;
+  return n <= (size - static_cast<std::uintmax_t>(at)) / each;
+}
+
+template <class T>
+static auto write(std::ostream& out, const T& v) noexcept -> void {
+  out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+auto TrajectoryCache::load(const std::filesystem::path& path) noexcept -> void {
+  auto in = std::ifstream{ path, std::ios::binary };
+  if (not in) {
+    ilog("no trajectory cache at {}", path.string());
+    return;
+  }
+
+  auto error = std::error_code{};
+  const auto size = std::filesystem::file_size(path, error);
+  if (error) {
+    elog("can't read trajectory cache {}: {}", path.string(), error.message());
+    return;
+  }
+
+  auto magic   = decltype(MAGIC){};
+  auto version = stk::u32{};
+  auto count   = stk::u64{};
+  if (not read(in, magic) or magic != MAGIC
+   or not read(in, version) or version != VERSION
+   or not read(in, count)
+  ) {
+    elog("ignoring trajectory cache {}, unknown format", path.string());
+    return;
+  }
+
+  auto loaded = std::vector<Entry>{};
+  for (auto _ : stdv::iota(stk::u64{ 0 }, count)) {
+    auto& entry = loaded.emplace_back();
+    if (not read(in, entry.key) or not read(in, entry.extents)) {
+      elog("ignoring trajectory cache {}, truncated", path.string());
+      return;
+    }
+
+    // counts are checked against what's left of the file before anything is allocated
+    auto cells = stk::u64{ 1 };
+    for (auto extent : entry.extents) {
+      if (cells != 0 and not fits(in, size, extent, static_cast<std::size_t>(cells))) {
+        elog("ignoring trajectory cache {}, corrupt", path.string());
+        return;
+      }
+      cells *= extent;
+    }
+    entry.start.resize(static_cast<std::size_t>(cells));
+    auto nsteps = stk::u32{};
+    if (not in.read(stdr::data(entry.start), static_cast<std::streamsize>(cells)) or not read(in, nsteps)) {
+      elog("ignoring trajectory cache {}, truncated", path.string());
+      return;
+    }
+
+    if (not fits(in, size, nsteps, sizeof(stk::u32))) {
+      elog("ignoring trajectory cache {}, corrupt", path.string());
+      return;
+    }
+    entry.steps.resize(nsteps);
+    for (auto& step : entry.steps) {
+      auto ndeltas = stk::u32{};
+      if (not read(in, ndeltas)) {
+        elog("ignoring trajectory cache {}, truncated", path.string());
+        return;
+      }
+      if (not fits(in, size, ndeltas, sizeof(stk::u32) + sizeof(char))) {
+        elog("ignoring trajectory cache {}, corrupt", path.string());
+        return;
+      }
+      step.resize(ndeltas);
+      for (auto& [i, value] : step) {
+        if (not read(in, i) or not read(in, value)) {
+          elog("ignoring trajectory cache {}, truncated", path.string());
+          return;
+        }
+        if (i >= cells) {
+          elog("ignoring trajectory cache {}, corrupt", path.string());
+          return;
+        }
+      }
+    }
+  }
+
+  auto lock = std::scoped_lock{ mutex };
+
+  // the file is saved most recent first
+  for (auto& entry : loaded | stdv::reverse | stdv::as_rvalue) {
+    if (index.contains(entry.key)) continue;
+    entries.push_front(std::move(entry));
+    index.emplace(entries.front().key, stdr::begin(entries));
+  }
+  evict();
+
+  ilog("loaded {} trajectories from {}", stdr::size(loaded), path.string());
+}
+
+auto TrajectoryCache::save(const std::filesystem::path& path) const noexcept -> void {
+  auto out = std::ofstream{ path, std::ios::binary | std::ios::trunc };
+  if (not out) {
+    elog("can't write trajectory cache to {}", path.string());
+    return;
+  }
+
+  auto lock = std::scoped_lock{ mutex };
+
+  write(out, MAGIC);
+  write(out, VERSION);
+  write(out, static_cast<stk::u64>(stdr::size(entries)));
+  for (const auto& entry : entries) {
+    write(out, entry.key);
+    write(out, entry.extents);
+    out.write(stdr::data(entry.start), static_cast<std::streamsize>(stdr::size(entry.start)));
+    write(out, static_cast<stk::u32>(stdr::size(entry.steps)));
+    for (const auto& step : entry.steps) {
+      write(out, static_cast<stk::u32>(stdr::size(step)));
+      for (const auto& [i, value] : step) {
+        write(out, i);
+        write(out, value);
+      }
+    }
+  }
+
+  ilog("saved {} trajectories to {}", stdr::size(entries), path.string());
+}
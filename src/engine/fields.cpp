@@ -3,39 +3,69 @@ module engine.fields;
 import stormkit.core;
 import geometry;
 
-// namespace stk  = stormkit;
+namespace stk  = stormkit;
 namespace stdr = std::ranges;
 namespace stdv = std::views;
 
-auto Field::potential(const Grid<char>& grid, Potential& potential) const noexcept -> void {
-  propagate(
-    mdiota(potential.area())
-      | stdv::filter([this, &grid](auto u) noexcept {
-          return zero.contains(grid[u]);
-      })
-      | stdv::transform([&potential](auto u) noexcept {
-          potential[u] = 0.0;
-          return std::tuple{ u, 0.0 };
-      }),
-    [this, &grid, &potential](auto&& front) noexcept {
-      static constexpr auto neigh_size = 3ul * Area3::Size{ 1, 1, 1 };
-      static constexpr auto neigh_shift = -static_cast<Area3::Offset>(neigh_size) / 2l;
-      static constexpr auto neigh = Area3{ neigh_shift, neigh_size };
-
-      auto [u, p] = front;
-      auto new_us = (neigh + u).meet(potential.area());
-      auto new_p  = inversed ? p - 1.0 : p + 1.0;
-      return mdiota(new_us)
-        | stdv::filter([this, &grid, &potential](auto n) noexcept {
-            return not is_normal(potential[n])
-               and substrate.contains(grid[n]);
-        })
-        | stdv::transform([&potential, new_p](auto n) noexcept {
-            potential[n] = new_p;
-            return std::tuple{ n, new_p };
-        });
+static auto symbols(const charset& set) noexcept -> std::bitset<256> {
+  auto bits = std::bitset<256>{};
+  for (auto c : set) bits.set(static_cast<unsigned char>(c));
+  return bits;
+}
+
+/**
+ * Breadth first from the zero cells over the substrate, on 32 bits flat indices.
+ * Planar grids only visit their 8 neighbours, the others their 26.
+ */
+template <bool PLANAR>
+static auto spread(const Field& field, const Grid<char>& grid, Potential& potential) noexcept -> void {
+  const auto X  = static_cast<stk::i32>(grid.extents.extent(2));
+  const auto Y  = static_cast<stk::i32>(grid.extents.extent(1));
+  const auto Z  = static_cast<stk::i32>(grid.extents.extent(0));
+  const auto XY = X * Y;
+
+  const auto zero      = symbols(field.zero);
+  const auto substrate = symbols(field.substrate);
+  const auto step      = field.inversed ? -1.0 : 1.0;
+
+  auto queue = std::vector<stk::u32>{};
+  for (auto i = 0u; i < stdr::size(grid.values); ++i) {
+    if (zero.test(static_cast<unsigned char>(grid.values[i]))) {
+      potential.values[i] = 0.0;
+      queue.push_back(i);
     }
-  );
+  }
+
+  for (auto head = 0uz; head < stdr::size(queue); ++head) {
+    const auto i = static_cast<stk::i32>(queue[head]);
+    const auto x = i % X;
+    const auto y = PLANAR ? i / X : i / X % Y;
+    const auto z = PLANAR ? 0     : i / XY;
+    const auto p = potential.values[i] + step;
+
+    for (auto dz = PLANAR ? 0 : -1; dz <= (PLANAR ? 0 : 1); ++dz) {
+      if (z + dz < 0 or z + dz >= Z) continue;
+      for (auto dy = -1; dy <= 1; ++dy) {
+        if (y + dy < 0 or y + dy >= Y) continue;
+        for (auto dx = -1; dx <= 1; ++dx) {
+          if (x + dx < 0 or x + dx >= X) continue;
+
+          const auto n = static_cast<stk::u32>(i + dz * XY + dy * X + dx);
+          if (not is_normal(potential.values[n])
+              and substrate.test(static_cast<unsigned char>(grid.values[n]))
+          ) {
+            potential.values[n] = p;
+            queue.push_back(n);
+          }
+        }
+      }
+    }
+  }
+}
+
+auto Field::potential(const Grid<char>& grid, Potential& potential) const noexcept -> void {
+  if (grid.extents.extent(0) == 1) spread<true>(*this, grid, potential);
+  else                             spread<false>(*this, grid, potential);
 }
 
 auto Field::potentials(const Fields& fields, const Grid<char>& grid, Potentials& potentials) noexcept -> void {
@@ -68,3 +98,14 @@ auto Field::essential_missing(const Fields& fields, const Potentials& potentials
     }
   );
 }
+
+auto Field::essential_absent(const Fields& fields, const Potentials& potentials, const TracedGrid<char>& grid) noexcept -> bool {
+  return stdr::any_of(fields, [&potentials, &grid](const auto& p) noexcept {
+      const auto& [c, f] = p;
+      // a potential that isn't recomputed is kept whatever the grid becomes
+      return f.essential
+         and (f.recompute or not potentials.contains(c))
+         and stdr::none_of(f.zero, std::bind_front(&TracedGrid<char>::count, &grid));
+    }
+  );
+}
@@ -5,94 +5,136 @@ import log;
 namespace stdr = std::ranges;
 namespace stdv = std::views;
 
-auto Match::scan(
+/** Rule index and origin cell index of a possible match, sorting them groups them by rule */
+using Candidates = std::vector<stk::u64>;
+
+static constexpr auto candidate(stk::usize r, stk::ioffset i) noexcept -> stk::u64 {
+  return static_cast<stk::u64>(r) << 32 | static_cast<stk::u64>(i);
+}
+
+/**
+ * Variants of a rule sharing its size, they share their anchors.
+ * The symmetries of a rule follow it, only the first one isn't a copy.
+ */
+static auto variants(std::span<const RewriteRule> rules) noexcept -> std::vector<std::vector<stk::usize>> {
+  auto classes = std::vector<std::vector<stk::usize>>{};
+  auto group   = 0uz;
+  for (auto r = 0uz; r < stdr::size(rules); ++r) {
+    if (not rules[r].is_copy) group = stdr::size(classes);
+
+    const auto size = rules[r].output.area().size;
+    auto same = stdr::find_if(
+      stdr::begin(classes) + static_cast<std::ptrdiff_t>(group), stdr::end(classes),
+      [&rules, size](const auto& rs) noexcept { return rules[rs.front()].output.area().size == size; }
+    );
+    if (same == stdr::end(classes)) classes.push_back({ r });
+    else                            same->push_back(r);
+  }
+  return classes;
+}
+
+/** Positions along an axis of `n` cells such that any `stride` consecutive cells hold one */
+static auto lattice(stk::usize n, stk::usize stride) noexcept -> std::vector<stk::ioffset> {
+  auto at = std::vector<stk::ioffset>{};
+  for (auto x = stride - 1; x < n; x += stride) at.push_back(static_cast<stk::ioffset>(x));
+  if (n > 0 and (stdr::empty(at) or at.back() != static_cast<stk::ioffset>(n - 1))) {
+    at.push_back(static_cast<stk::ioffset>(n - 1));
+  }
+  return at;
+}
+
+/** Origins of the rule placements reading `c` at `u` */
+static auto shifted(
+  const Grid<char>& grid,
+  std::span<const RewriteRule> rules,
+  stk::usize r, Area3::Offset u, char c,
+  Candidates& out
+) noexcept -> void {
+  const auto g_area = grid.area();
+  for (auto shift : rules[r].ishifts(c)) {
+    auto ru_area = rules[r].bounds + (u - shift);
+    if (g_area.meet(ru_area) == ru_area) out.push_back(candidate(r, toIndex(u - shift, grid.extents)));
+  }
+}
+
+static auto unique(Candidates& candidates) noexcept -> void {
+  stdr::sort(candidates);
+  candidates.erase(stdr::begin(stdr::unique(candidates)), stdr::end(candidates));
+}
+
+/** Placements around the changed cells, each changed cell is read once for all the rules */
+static auto around(
   const Grid<char>& grid,
   std::span<const RewriteRule> rules,
   std::span<const Change<char>> history
-) noexcept -> std::vector<Match> {
-  if (not stdr::empty(history)) {
-    return {
-      std::from_range,
-      stdv::zip(rules, stdv::iota(0u))
-        | stdv::transform([&grid, &history](const auto& v) noexcept {
-            const auto& [rule, r] = v;
-            return history
-              | stdv::transform(&Change<char>::u)
-              // TODO group changes according to rule size
-              // currently this is highly redundant on adjacent changes (which happens a lot..)
-              | stdv::transform([&grid, &rule](auto u) noexcept {
-                  return rule.get_ishifts(grid[u])
-                    | stdv::transform(std::bind_front(std::minus<Area3::Offset>{}, u))
-                    | stdv::filter([g_area = grid.area(), r_area = rule.input.area()](auto u) noexcept {
-                        auto ru_area = r_area + u;
-                        return g_area.meet(ru_area) == ru_area;
-                    });
-              })
-              | stdv::join
-              | stdr::to<std::unordered_set>()
-              | stdv::transform([r](auto u) noexcept {
-                  return std::tuple{ u, r };
-              });
-        })
-        | stdv::join
-        | stdv::transform([rules](auto&& ur) noexcept {
-            return Match{ rules, std::get<0>(ur), std::get<1>(ur) };
-        })
-        | stdv::filter(std::bind_back(&Match::match, std::cref(grid)))
-    };
+) noexcept -> Candidates {
+  auto candidates = Candidates{};
+  for (const auto& change : history) {
+    const auto u = fromIndex(change.i, grid.extents);
+    const auto c = grid.values[change.i];
+    for (auto r = 0uz; r < stdr::size(rules); ++r) shifted(grid, rules, r, u, c, candidates);
   }
+  unique(candidates);
+  return candidates;
+}
 
-  return {
-    std::from_range,
-    stdv::zip(rules, stdv::iota(0u))
-      | stdv::transform([&grid](const auto& v) noexcept {
-          const auto& [rule, r] = v;
-          const auto g_area = grid.area();
-          return mdiota(g_area)
-            | stdv::filter([r_area = rule.output.area(), g_area](auto u) noexcept {
-                return glm::all(
-                     glm::equal(u, g_area.shiftmax())
-                  or glm::equal(u % static_cast<Area3::Offset>(r_area.size), r_area.shiftmax())
-                );
-            })
-            | stdv::transform([&grid, &rule](auto u) noexcept {
-                return rule.get_ishifts(grid[u])
-                  | stdv::transform(std::bind_front(std::minus<Area3::Offset>{}, u))
-                  | stdv::filter([g_area = grid.area(), r_area = rule.input.area()](auto u) noexcept {
-                      auto ru_area = r_area + u;
-                      return g_area.meet(ru_area) == ru_area;
-                  });
-            })
-            | stdv::join
-            | stdv::transform([r](auto u) noexcept {
-                return std::tuple{ u, r };
-            });
-      })
-      | stdv::join
-      | stdv::transform([rules](auto&& ur) noexcept {
-          return Match{ rules, std::get<0>(ur), std::get<1>(ur) };
-      })
-      | stdv::filter(std::bind_back(&Match::match, std::cref(grid)))
-  };
+/**
+ * Placements anywhere in the grid : every placement of a rule holds one of its anchors.
+ * Variants of the same size are anchored together, reading each anchor once.
+ */
+static auto everywhere(
+  const Grid<char>& grid,
+  std::span<const RewriteRule> rules
+) noexcept -> Candidates {
+  auto candidates = Candidates{};
+  const auto g_size = fromExtents(grid.extents);
+  for (const auto& rs : variants(rules)) {
+    const auto size = rules[rs.front()].output.area().size;
+    const auto xs = lattice(g_size.x, size.x);
+    const auto ys = lattice(g_size.y, size.y);
+    const auto zs = lattice(g_size.z, size.z);
+    for (auto z : zs) for (auto y : ys) for (auto x : xs) {
+      const auto u = Area3::Offset{ x, y, z };
+      const auto c = grid[u];
+      for (auto r : rs) shifted(grid, rules, r, u, c, candidates);
+    }
+  }
+  unique(candidates);
+  return candidates;
 }
 
-auto Match::match(const Grid<char>& grid) const noexcept -> bool {
-  // return stdr::mismatch(
-  //   rules[r].input, mdiota(area()),
-  //   [](const auto& i, char c) static noexcept {
-  //     return not i or i->contains(c);
-  //   },
-  //   {}, [&grid](auto u) { return grid[u]; }
-  // )
-  //   .in1 == stdr::end(rules[r].input);
-  return stdr::all_of(
-    stdv::zip(mdiota(area()), rules[r].input),
-    [&grid](const auto& input) noexcept {
-      auto [u, i] = input;
-      return not i
-          or i->contains(grid[u]);
+/** Calls `emit` with the rule index and origin cell index of the candidates found in the grid */
+static auto matching(
+  const Grid<char>& grid,
+  std::span<const RewriteRule> rules,
+  const Candidates& candidates,
+  auto&& emit
+) noexcept -> void {
+  for (auto key : candidates) {
+    const auto r = static_cast<stk::usize>(key >> 32);
+    const auto i = static_cast<stk::u32>(key);
+    if (rules[r].match(grid, i)) emit(r, i);
+  }
+}
+
+auto Match::scan(
+  const Grid<char>& grid,
+  std::span<const RewriteRule> rules,
+  std::span<const Change<char>> history
+) noexcept -> std::vector<Match> {
+  auto found = std::vector<Match>{};
+  matching(
+    grid, rules,
+    stdr::empty(history) ? everywhere(grid, rules) : around(grid, rules, history),
+    [&found, &grid, rules](auto r, auto i) noexcept {
+      found.push_back(Match{ rules, fromIndex(i, grid.extents), static_cast<stk::ioffset>(r) });
     }
   );
+  return found;
+}
+
+auto Match::match(const Grid<char>& grid) const noexcept -> bool {
+  return rules[r].match(grid, static_cast<stk::u32>(toIndex(u, grid.extents)));
 }
 
 auto Match::conflict(const Match& other) const noexcept -> bool {
@@ -105,17 +147,16 @@ auto Match::conflict(const Match& other) const noexcept -> bool {
   );
 }
 
-auto Match::changes(const Grid<char>& grid) const noexcept -> std::vector<Change<char>> {
-  return stdv::zip(mdiota(area()), rules[r].output)
-    | stdv::filter([&grid](const auto& output) noexcept {
-        auto [u, o] = output;
-        return  o
-           and *o != grid[u];
-    })
-    | stdv::transform([](auto&& output) static noexcept {
-        return Change{std::get<0>(output), *std::get<1>(output)};
-    })
-    | stdr::to<std::vector>();
+auto Match::changes(const Grid<char>& grid, std::vector<Change<char>>& out) const noexcept -> void {
+  const auto& output = rules[r].output;
+  for (auto&& [values, outputs] : stdv::zip(grid.rows(area()), output.rows(output.area()))) {
+    const auto first = static_cast<stk::u32>(stdr::data(values) - stdr::data(grid.values));
+    for (auto x = 0uz; x < stdr::size(values); ++x) {
+      if (outputs[x] and *outputs[x] != values[x]) {
+        out.emplace_back(first + static_cast<stk::u32>(x), *outputs[x]);
+      }
+    }
+  }
 }
 
 auto Match::delta(const Grid<char>& grid, const Potentials& potentials) const noexcept -> double {
@@ -168,18 +209,14 @@ auto Match::forward_match(const Potentials& potentials, double p) const noexcept
       | stdv::filter([](const auto& input) static noexcept {
           return std::get<1>(input) != std::nullopt;
       }),
-    [p](auto current) noexcept {
-      return is_normal(current)
-         and current <= p;
-    },
-    [&potentials](const auto& input) noexcept {
+    [&potentials, p](const auto& input) noexcept {
       auto [u, i] = input;
-      auto im = stdr::max(*i, {}, [&potentials, u] (auto i) {
-        return potentials.contains(i) ? potentials.at(i)[u]
-          : std::numeric_limits<double>::quiet_NaN();
+      // the cell can hold one of the accepted values by then
+      return stdr::any_of(*i, [&potentials, u, p](auto c) noexcept {
+        return potentials.contains(c)
+           and is_normal(potentials.at(c)[u])
+           and potentials.at(c)[u] <= p;
       });
-      return potentials.contains(im) ? potentials.at(im)[u]
-        : std::numeric_limits<double>::quiet_NaN();
     }
   );
 }
@@ -187,22 +224,21 @@ auto Match::forward_match(const Potentials& potentials, double p) const noexcept
 auto Match::backward_changes(const Potentials& potentials, double p) const noexcept
 -> std::vector<Change<std::tuple<char, double>>> {
   return stdv::zip(mdiota(area()), rules[r].input)
-    | stdv::filter([&potentials](const auto& input) noexcept {
-        auto [u, i] = input;
-        if (not i) return false;
-        auto im = stdr::max(*i, {}, [&potentials, u] (auto i) {
-          return potentials.contains(i) ? potentials.at(i)[u]
-            : std::numeric_limits<double>::quiet_NaN();
-        });
-        return is_normal(potentials.at(im)[u]);
+    | stdv::filter([](const auto& input) static noexcept {
+        return std::get<1>(input) != std::nullopt;
     })
-    | stdv::transform([&potentials, p](auto&& input) noexcept {
-        auto im = stdr::max(*std::get<1>(input), {}, [&potentials, u = std::get<0>(input)] (auto i) {
-          return potentials.contains(i) ? potentials.at(i)[u]
-            : std::numeric_limits<double>::quiet_NaN();
-        });
-        return Change{ std::get<0>(input), std::tuple{ im, p }};
+    | stdv::transform([&potentials, p](const auto& input) noexcept {
+        auto [u, i] = input;
+        return *i
+          | stdv::filter([&potentials, u](auto c) noexcept {
+              return not potentials.contains(c)
+                  or not is_normal(potentials.at(c)[u]);
+          })
+          | stdv::transform([u, p](auto c) noexcept {
+              return Change{ u, std::tuple{ c, p } };
+          });
     })
+    | stdv::join
     | stdr::to<std::vector>();
 }
 
@@ -212,10 +248,63 @@ auto Match::forward_changes(const Potentials& potentials, double p) const noexce
     | stdv::filter([&potentials](const auto& output) noexcept {
         auto [u, o] = output;
         return o
-           and is_normal(potentials.at(*o)[u]);
+           and not is_normal(potentials.at(*o)[u]);
     })
     | stdv::transform([p](auto&& output) noexcept {
         return Change{ std::get<0>(output), std::tuple{ *std::get<1>(output), p }};
     })
     | stdr::to<std::vector>();
 }
+
+auto Matches::push_back(const Match& match) noexcept -> void {
+  cells.push_back(static_cast<stk::u32>(toIndex(match.u, extents)));
+  ruleids.push_back(static_cast<stk::u16>(match.r));
+  if (not stdr::empty(weights)) weights.push_back(match.w);
+}
+
+auto Matches::swap(std::size_t a, std::size_t b) noexcept -> void {
+  std::swap(cells[a], cells[b]);
+  std::swap(ruleids[a], ruleids[b]);
+  if (not stdr::empty(weights)) std::swap(weights[a], weights[b]);
+}
+
+auto Matches::truncate(std::size_t k) noexcept -> void {
+  cells.resize(k);
+  ruleids.resize(k);
+  if (not stdr::empty(weights)) weights.resize(k);
+}
+
+auto Matches::clear() noexcept -> void {
+  cells.clear();
+  ruleids.clear();
+  weights.clear();
+}
+
+auto Matches::weigh() noexcept -> void {
+  weights.resize(size(), 1.0);
+}
+
+auto Matches::filter(const Grid<char>& grid) noexcept -> void {
+  auto kept = 0uz;
+  for (auto k = 0uz; k < size(); ++k) {
+    if (not rules[ruleids[k]].match(grid, cells[k])) continue;
+    cells[kept]   = cells[k];
+    ruleids[kept] = ruleids[k];
+    if (not stdr::empty(weights)) weights[kept] = weights[k];
+    ++kept;
+  }
+  truncate(kept);
+}
+
+auto Matches::scan(const Grid<char>& grid, std::span<const Change<char>> history) noexcept -> void {
+  extents = grid.extents;
+  matching(
+    grid, rules,
+    stdr::empty(history) ? everywhere(grid, rules) : around(grid, rules, history),
+    [this](auto r, auto i) noexcept {
+      cells.push_back(i);
+      ruleids.push_back(static_cast<stk::u16>(r));
+      if (not stdr::empty(weights)) weights.push_back(1.0);
+    }
+  );
+}
@@ -16,7 +16,7 @@ auto Observe::future(std::vector<Change<char>>& changes, std::optional<Future>&
       if (observes.contains(value)) {
         values.insert(value);
         const auto& obs = observes.at(value);
-        if (obs.from) changes.emplace_back(u, *obs.from);
+        if (obs.from) changes.emplace_back(static_cast<stk::u32>(toIndex(u, grid.extents)), *obs.from);
         return obs.to;
       }
       else {
@@ -33,6 +33,12 @@ auto Observe::future(std::vector<Change<char>>& changes, std::optional<Future>&
   }
 }
 
+auto Observe::absent(const Observes& observes, const TracedGrid<char>& grid) noexcept -> bool {
+  return stdr::any_of(observes | stdv::keys, [&grid](auto c) noexcept {
+    return grid.count(c) == 0;
+  });
+}
+
 auto Observe::backward_potentials(Potentials& potentials, const Future& future, std::span<const RewriteRule> rules) noexcept -> void {
   propagate(
     stdv::zip(mdiota(future.area()), future)
@@ -53,7 +59,7 @@ auto Observe::backward_potentials(Potentials& potentials, const Future& future,
       auto p = potentials.at(c)[u];
       return stdv::iota(0u, stdr::size(rules))
         | stdv::filter([p_area = potentials.at(c).area(), &rules, u](auto r) noexcept {
-            auto ru_area = rules[r].input.area() + u;
+            auto ru_area = rules[r].bounds + u;
             return p_area.meet(ru_area) == ru_area;
         })
         | stdv::transform([&rules, u](auto r) noexcept {
@@ -0,0 +1,210 @@
+module engine.program;
+
+import log;
+import utils;
+import random;
+
+namespace stk  = stormkit;
+namespace stdr = std::ranges;
+namespace stdv = std::views;
+
+using clk = std::chrono::steady_clock;
+
+static constexpr auto SEARCH_POLLING = std::chrono::milliseconds{ 16 };
+
+auto Execution::stepped(const TracedGrid<char>& grid) noexcept -> void {
+  ++steps;
+  if (limit != 0 and steps >= limit) {
+    stopped = true;
+  }
+  else if (interval != 0 and checkpoint and steps % interval == 0) {
+    stopped = not checkpoint(grid, steps);
+  }
+}
+
+Program::Program(NodeRunner&& tree) noexcept {
+  compile(std::move(tree), NONE);
+}
+
+Program::Program(std::vector<Node>&& _nodes, std::vector<RuleNode>&& _rules) noexcept
+: nodes{std::move(_nodes)}, rules{std::move(_rules)}
+{}
+
+auto Program::compile(NodeRunner&& n, std::size_t parent) noexcept -> void {
+  auto index = stdr::size(nodes);
+
+  std::move(n).visit(Visitor{
+    [this, index, parent](RuleRunner&& r) noexcept {
+      nodes.push_back(Node{
+        .kind = Node::Kind::RULE,
+        .parent = parent,
+        .end = index + 1,
+        .rule = stdr::size(rules),
+        .steps = r.steps,
+        .order = r.order,
+      });
+      rules.push_back(std::move(r.rulenode));
+    },
+    [this, index, parent](TreeRunner&& t) noexcept {
+      nodes.push_back(Node{
+        .kind = t.mode == TreeRunner::Mode::MARKOV ? Node::Kind::MARKOV
+                                                   : Node::Kind::SEQUENCE,
+        .parent = parent,
+        .end = NONE,
+        .order = t.order,
+      });
+
+      auto prev = NONE;
+      for (auto& child : t.nodes) {
+        auto c = stdr::size(nodes);
+        compile(std::move(child), index);
+        if (prev != NONE) nodes[prev].next = c;
+        prev = c;
+      }
+      nodes[index].end = stdr::size(nodes);
+    },
+  });
+}
+
+ProgramState::ProgramState(const Program& _program) noexcept
+: program{&_program},
+  nodes(stdr::size(_program.nodes)),
+  rules(stdr::size(_program.rules))
+{}
+
+auto ProgramState::step(TracedGrid<char>& grid) noexcept -> Status {
+  while (pc != Program::NONE) {
+    const auto& node  = program->nodes[pc];
+    auto&       state = nodes[pc];
+
+    if (node.kind != Program::Node::Kind::RULE) {
+      state.found = false;
+      pc = program->first(pc) != Program::NONE ? program->first(pc) : back(pc, false);
+      continue;
+    }
+
+    if (node.steps != 0 and state.step >= node.steps) {
+      pc = back(pc, false);
+      continue;
+    }
+
+    const auto& rulenode  = program->rules[node.rule];
+    auto&       rulestate = rules[node.rule];
+    auto start = profiling ? clk::now() : clk::time_point{};
+
+    changes.clear();
+    rulenode(grid, rulestate, changes);
+    if (stdr::empty(changes) and rulestate.waiting()) {
+      rulestate.wait(SEARCH_POLLING);
+      rulenode(grid, rulestate, changes);
+    }
+
+    ++state.counters.invocations;
+    if (profiling) state.counters.time += clk::now() - start;
+
+    if (stdr::empty(changes)) {
+      if (rulestate.waiting()) return Status::WAIT;
+
+      pc = back(pc, false);
+      continue;
+    }
+
+    grid.apply(changes);
+    ++state.step;
+    ++state.counters.steps;
+
+    pc = back(pc, true);
+    return Status::STEP;
+  }
+
+  return Status::HALT;
+}
+
+auto ProgramState::run(TracedGrid<char>& grid, Execution& execution) noexcept -> bool {
+  while (not execution.stopped) {
+    switch (step(grid)) {
+      case Status::STEP: execution.stepped(grid); break;
+      case Status::WAIT: break;
+      case Status::HALT: return true;
+    }
+  }
+  return false;
+}
+
+auto ProgramState::back(std::size_t child, bool found) noexcept -> std::size_t {
+  const auto& tree_nodes = program->nodes;
+  for (;;) {
+    auto parent = tree_nodes[child].parent;
+    if (parent == Program::NONE) {
+      return Program::NONE;
+    }
+
+    const auto& tree = tree_nodes[parent];
+    if (found) {
+      nodes[parent].found = true;
+      return tree.kind == Program::Node::Kind::MARKOV ? program->first(parent) : child;
+    }
+
+    if (tree_nodes[child].next != Program::NONE) {
+      // a sequence never comes back to a failed child before it is done, nothing of it needs to be kept
+      if (tree.kind == Program::Node::Kind::SEQUENCE and tree_nodes[child].kind == Program::Node::Kind::RULE) {
+        rules[tree_nodes[child].rule].reset();
+      }
+      return tree_nodes[child].next;
+    }
+
+    // every child failed, the tree is done and returns whether any of them stepped
+    reset(parent + 1, tree.end);
+    found = nodes[parent].found;
+    child = parent;
+  }
+}
+
+auto ProgramState::reset(std::size_t first, std::size_t last) noexcept -> void {
+  for (auto i : stdv::iota(first, last)) {
+    nodes[i].step  = 0;
+    nodes[i].found = false;
+    if (program->nodes[i].kind == Program::Node::Kind::RULE) rules[program->nodes[i].rule].reset();
+  }
+}
+
+auto ProgramState::reset() noexcept -> void {
+  reset(0, stdr::size(nodes));
+  pc = 0;
+}
+
+auto ProgramState::seed(stk::u64 s) noexcept -> void {
+  const auto& tree_nodes = program->nodes;
+  auto seeds = std::vector<stk::u64>(stdr::size(tree_nodes));
+  if (not stdr::empty(seeds)) seeds[0] = s;
+
+  for (auto i : stdv::iota(0uz, stdr::size(tree_nodes))) {
+    if (tree_nodes[i].kind == Program::Node::Kind::RULE) {
+      rules[tree_nodes[i].rule].seed(seeds[i]);
+      continue;
+    }
+
+    for (auto c = program->first(i); c != Program::NONE; c = tree_nodes[c].next) {
+      seeds[c] = derive(seeds[i], static_cast<stk::u64>(tree_nodes[c].order));
+    }
+  }
+}
+
+auto ProgramState::current() const noexcept -> const RuleState* {
+  if (pc == Program::NONE or program->nodes[pc].kind != Program::Node::Kind::RULE) return nullptr;
+  return &rules[program->nodes[pc].rule];
+}
+
+auto ProgramState::active(std::size_t i) const noexcept -> bool {
+  return pc != Program::NONE and i <= pc and pc < program->nodes[i].end;
+}
+
+auto Program::first(std::size_t i) const noexcept -> std::size_t {
+  return nodes[i].kind != Node::Kind::RULE and nodes[i].end > i + 1 ? i + 1 : NONE;
+}
+
+auto Program::depth(std::size_t i) const noexcept -> std::size_t {
+  auto d = 0uz;
+  for (auto p = nodes[i].parent; p != NONE; p = nodes[p].parent) ++d;
+  return d;
+}
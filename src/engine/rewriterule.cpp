@@ -24,55 +24,88 @@ auto RewriteRule::parse(
   };
 }
 
+template <stk::usize W, stk::usize H>
+static auto fixed(std::span<const Accepted> cells) noexcept -> Matcher {
+  auto matcher = FixedMatcher<W, H>{};
+  stdr::copy(cells, stdr::begin(matcher.cells));
+  return matcher;
+}
+
+static auto accepted(const Grid<RewriteRule::Input>& input) noexcept -> std::vector<Accepted> {
+  return input.values
+    | stdv::transform([](const auto& i) static noexcept {
+        auto accepted = Accepted{};
+        if (not i) return accepted.set();
+        for (auto c : *i) accepted.set(static_cast<unsigned char>(c));
+        return accepted;
+    })
+    | stdr::to<std::vector>();
+}
+
+/** The fixed size matcher fitting the input if any */
+static auto compile(std::vector<Accepted>&& cells, Area3::Size size) noexcept -> Matcher {
+  if (size.z == 1) {
+    if (size.x == 1 and size.y == 1) return fixed<1, 1>(cells);
+    if (size.x == 2 and size.y == 1) return fixed<2, 1>(cells);
+    if (size.x == 1 and size.y == 2) return fixed<1, 2>(cells);
+    if (size.x == 3 and size.y == 1) return fixed<3, 1>(cells);
+    if (size.x == 1 and size.y == 3) return fixed<1, 3>(cells);
+    if (size.x == 2 and size.y == 2) return fixed<2, 2>(cells);
+    if (size.x == 3 and size.y == 3) return fixed<3, 3>(cells);
+  }
+  return GenericMatcher{ size, std::move(cells) };
+}
+
 RewriteRule::RewriteRule(Grid<Input>&& _input, Grid<Output>&& _output, double p, bool _is_copy) noexcept
 : input{std::move(_input)},
   output{std::move(_output)},
   draw{p},
   is_copy{_is_copy},
-  ishifts{
-    std::from_range,
-    stdv::zip(input, mdiota(input.area()))
-      | stdv::transform([](auto&& p) noexcept {
-          auto [i, u] = p;
-          // TODO this must change when fixing size of state representation
-          return i.value_or(std::unordered_set{ IGNORED_SYMBOL }) 
-            | stdv::transform([u](auto c) noexcept {
-                return std::tuple{ c, u };
-            });
-      })
-      | stdv::join
-  },
-  oshifts{
-    std::from_range,
-    stdv::zip(output, mdiota(output.area()))
-      | stdv::transform([](auto&& p) noexcept {
-          auto [o, u] = p;
-          return std::tuple{ o.value_or(IGNORED_SYMBOL), u };
-      })
+  bounds{input.area()}
+{
+  auto cells = accepted(input);
+
+  auto ignored = std::vector<Area3::Offset>{};
+  auto symbols = Accepted{};
+  for (auto&& [cell, u] : stdv::zip(cells, mdiota(input.area()))) {
+    if (cell.all()) ignored.push_back(u);
+    else            symbols |= cell;
   }
-{}
 
-auto RewriteRule::get_ishifts(char c) const noexcept -> std::vector<Area3::Offset>{
-  auto shifts = std::vector<Area3::Offset>{};
+  shifts = ignored;
+  shiftstarts = { 0, static_cast<stk::u32>(stdr::size(shifts)) };
+  for (auto c : stdv::iota(0u, 256u)) {
+    if (not symbols.test(c)) continue;
 
-  auto ignored_bucket = ishifts.bucket(IGNORED_SYMBOL);
-  auto bucket         = ishifts.bucket(c);
+    shiftrows[c] = static_cast<stk::u16>(stdr::size(shiftstarts) - 1);
+    shifts.append_range(ignored);
+    for (auto&& [cell, u] : stdv::zip(cells, mdiota(input.area()))) {
+      if (not cell.all() and cell.test(c)) shifts.push_back(u);
+    }
+    shiftstarts.push_back(static_cast<stk::u32>(stdr::size(shifts)));
+  }
+
+  matcher = compile(std::move(cells), fromExtents(input.extents));
+}
 
-  shifts.append_range(
-    stdr::subrange(ishifts.cbegin(ignored_bucket), ishifts.cend(ignored_bucket))
-      | stdv::transform(stk::monadic::get<1>())
-  );
-  shifts.append_range(
-    stdr::subrange(ishifts.cbegin(bucket), ishifts.cend(bucket))
-      | stdv::transform(stk::monadic::get<1>())
-  );
+auto RewriteRule::ishifts(char c) const noexcept -> std::span<const Area3::Offset> {
+  const auto row = shiftrows[static_cast<unsigned char>(c)];
+  return std::span{ shifts }.subspan(shiftstarts[row], shiftstarts[row + 1] - shiftstarts[row]);
+}
 
-  return shifts;
+auto RewriteRule::match(const Grid<char>& grid, stk::u32 i) const noexcept -> bool {
+  const auto* origin  = stdr::data(grid.values) + i;
+  const auto  ystride = grid.extents.extent(2);
+  const auto  zstride = grid.extents.extent(2) * grid.extents.extent(1);
+  return std::visit([origin, ystride, zstride](const auto& m) noexcept {
+    return m(origin, ystride, zstride);
+  }, matcher);
 }
 
 auto RewriteRule::operator==(const RewriteRule& other) const noexcept -> bool {
   return input    == other.input
      and output   == other.output
+     and bounds   == other.bounds
      and draw.p() == other.draw.p();
 }
 
@@ -82,38 +115,117 @@ auto RewriteRule::backward_neighborhood() const noexcept -> Area3 {
   return a + shift;
 }
 
+auto RewriteRule::trimmed() const noexcept -> RewriteRule {
+  auto lo = Area3::Offset{ 0, 0, 0 };
+  auto hi = static_cast<Area3::Offset>(fromExtents(input.extents));
+
+  auto ignored = [this, &lo, &hi](stk::usize axis, stk::ioffset at) noexcept {
+    auto plane = Area3{ lo, static_cast<Area3::Size>(hi - lo) };
+    plane.u[axis]    = at;
+    plane.size[axis] = 1;
+    return stdr::all_of(mdiota(plane), [this](auto u) noexcept {
+      return not input[u] and not output[u];
+    });
+  };
+
+  // a rule ignoring every cell keeps one of them
+  for (auto axis : { 0uz, 1uz, 2uz }) {
+    while (hi[axis] - lo[axis] > 1 and ignored(axis, lo[axis]))     ++lo[axis];
+    while (hi[axis] - lo[axis] > 1 and ignored(axis, hi[axis] - 1)) --hi[axis];
+  }
+
+  const auto kept = Area3{ lo, static_cast<Area3::Size>(hi - lo) };
+  auto rule = RewriteRule{ input.crop(kept), output.crop(kept), draw.p(), is_copy };
+  rule.bounds = bounds - lo;
+  return rule;
+}
+
+auto RewriteRule::narrowed(const Accepted& symbols) const noexcept -> RewriteRule {
+  auto rule = RewriteRule{
+    {
+      std::from_range,
+      input | stdv::transform([&symbols](const auto& i) noexcept -> Input {
+        if (not i) return std::nullopt;
+        return *i
+          | stdv::filter([&symbols](auto c) noexcept { return symbols.test(static_cast<unsigned char>(c)); })
+          | stdr::to<charset>();
+      }),
+      input.extents
+    },
+    { std::from_range, output, input.extents },
+    draw.p(),
+    is_copy
+  };
+  rule.bounds = bounds;
+  return rule;
+}
+
 auto RewriteRule::identity() const noexcept -> RewriteRule {
-  return {
+  auto rule = RewriteRule{
     { std::from_range, input, input.extents },
     { std::from_range, output, input.extents },
     draw.p(),
     false
   };
+  rule.bounds = bounds;
+  return rule;
 }
 
+// bounds follow the cells : with s the rule size, a cell v lands on the transformed position of v
+
 auto RewriteRule::xreflected() const noexcept -> RewriteRule {
-  return {
+  auto rule = RewriteRule{
     input.xreflected(),
     output.xreflected(),
     draw.p(),
     true
   };
+  const auto s = static_cast<Area3::Offset>(fromExtents(input.extents));
+  const auto S = static_cast<Area3::Offset>(bounds.size);
+  const auto a = bounds.u;
+  rule.bounds = Area3{ { s.x - a.x - S.x, a.y, a.z }, ::xreflected(bounds).size };
+  return rule;
 }
 
 auto RewriteRule::xyrotated() const noexcept -> RewriteRule {
-  return {
+  auto rule = RewriteRule{
     input.xyrotated(),
     output.xyrotated(),
     draw.p(),
     true
   };
+  const auto s = static_cast<Area3::Offset>(fromExtents(input.extents));
+  const auto S = static_cast<Area3::Offset>(bounds.size);
+  const auto a = bounds.u;
+  rule.bounds = Area3{ { s.y - a.y - S.y, a.x, a.z }, ::xyrotated(bounds).size };
+  return rule;
 }
 
 auto RewriteRule::zyrotated() const noexcept -> RewriteRule {
-  return {
+  auto rule = RewriteRule{
     input.zyrotated(),
     output.zyrotated(),
     draw.p(),
     true
   };
+  const auto s = static_cast<Area3::Offset>(fromExtents(input.extents));
+  const auto S = static_cast<Area3::Offset>(bounds.size);
+  const auto a = bounds.u;
+  rule.bounds = Area3{ { a.x, a.z, s.y - a.y - S.y }, ::zyrotated(bounds).size };
+  return rule;
+}
+
+auto std::hash<RewriteRule>::operator()(const RewriteRule& rule) const noexcept -> std::size_t {
+  auto h = std::hash<stk::usize>{}(rule.input.extents.extent(0))
+         ^ std::hash<stk::usize>{}(rule.input.extents.extent(1)) << 1
+         ^ std::hash<stk::usize>{}(rule.input.extents.extent(2)) << 2
+         ^ std::hash<double>{}(rule.draw.p());
+  for (auto&& [i, o] : stdv::zip(rule.input, rule.output)) {
+    // charsets are unordered
+    auto cell = stk::u64{ 0 };
+    if (i) for (auto c : *i) cell += std::hash<char>{}(c) * 0x9e3779b97f4a7c15ull;
+    if (o) cell ^= std::hash<char>{}(*o) << 32 | 1u;
+    h = std::rotl(h, 5) ^ cell;
+  }
+  return h;
 }
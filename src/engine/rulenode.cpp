@@ -1,6 +1,7 @@
 module engine.rulenode;
 
 import sort;
+import engine.cache;
 import geometry;
 
 import log;
@@ -9,40 +10,155 @@ namespace stk  = stormkit;
 namespace stdr = std::ranges;
 namespace stdv = std::views;
 
+static auto required_symbols(std::span<const RewriteRule> rules) noexcept -> std::vector<std::vector<std::string>> {
+  return rules
+    | stdv::transform([](const auto& rule) static noexcept {
+        auto sets = rule.input.values
+          | stdv::filter([](const auto& input) static noexcept { return input.has_value(); })
+          | stdv::transform([](const auto& input) static noexcept {
+              auto set = *input | stdr::to<std::string>();
+              stdr::sort(set);
+              return set;
+          })
+          | stdr::to<std::vector>();
+        stdr::sort(sets);
+        sets.erase(stdr::begin(stdr::unique(sets)), stdr::end(sets));
+        return sets;
+    })
+    | stdr::to<std::vector>();
+}
+
+/** Symbols a rule input can read, a match can only appear where one of them is written */
+static auto input_alphabet(std::span<const RewriteRule> rules) noexcept -> std::string {
+  auto symbols = std::bitset<256>{};
+  for (const auto& rule : rules) {
+    for (const auto& input : rule.input.values) {
+      if (not input) continue;
+      for (auto c : *input) symbols.set(static_cast<unsigned char>(c));
+    }
+  }
+
+  auto alphabet = std::string{};
+  for (auto c : stdv::iota(0u, 256u)) {
+    if (symbols.test(c)) alphabet.push_back(static_cast<char>(c));
+  }
+  return alphabet;
+}
+
+static auto parsed_order(std::span<const RewriteRule> rules) noexcept -> std::vector<stk::u16> {
+  return stdv::iota(0uz, stdr::size(rules))
+    | stdv::transform([](auto r) static noexcept { return static_cast<stk::u16>(r); })
+    | stdr::to<std::vector>();
+}
+
 RuleNode::RuleNode(RuleNode::Mode _mode, std::vector<RewriteRule>&& _rules, RewriteRule::Unions&& _unions) noexcept 
 : mode{_mode}, rules{std::move(_rules)}, unions{std::move(_unions)}
-{}
+{
+  origins  = parsed_order(rules);
+  alphabet = input_alphabet(rules);
+  required = required_symbols(rules);
+}
 
 RuleNode::RuleNode(RuleNode::Mode _mode, std::vector<RewriteRule>&& _rules, RewriteRule::Unions&& _unions, Fields&& _fields, double _temperature) noexcept 
 : mode{_mode}, rules{std::move(_rules)}, unions{std::move(_unions)},
   inference{Inference::DISTANCE}, temperature{_temperature}, fields{std::move(_fields)}
-{}
+{
+  origins  = parsed_order(rules);
+  alphabet = input_alphabet(rules);
+  required = required_symbols(rules);
+}
 
 RuleNode::RuleNode(RuleNode::Mode _mode, std::vector<RewriteRule>&& _rules, RewriteRule::Unions&& _unions, Observes&& _observes, double _temperature) noexcept 
 : mode{_mode}, rules{std::move(_rules)}, unions{std::move(_unions)},
   inference{Inference::OBSERVE}, temperature{_temperature}, observes{std::move(_observes)}
-{}
+{
+  origins  = parsed_order(rules);
+  alphabet = input_alphabet(rules);
+  required = required_symbols(rules);
+}
 
-RuleNode::RuleNode(RuleNode::Mode _mode, std::vector<RewriteRule>&& _rules, RewriteRule::Unions&& _unions, Observes&& _observes, stk::cpp::UInt _limit, double _depthCoefficient) noexcept 
+RuleNode::RuleNode(RuleNode::Mode _mode, std::vector<RewriteRule>&& _rules, RewriteRule::Unions&& _unions, Observes&& _observes, Search&& _search) noexcept 
 : mode{_mode}, rules{std::move(_rules)}, unions{std::move(_unions)},
-  inference{Inference::SEARCH}, limit{_limit}, depthCoefficient{_depthCoefficient}, observes{std::move(_observes)}
-{}
+  inference{Inference::SEARCH}, search{std::move(_search)}, observes{std::move(_observes)}
+{
+  origins  = parsed_order(rules);
+  alphabet = input_alphabet(rules);
+  required = required_symbols(rules);
+}
+
+auto RuleNode::operator()(TracedGrid<char>& grid, RuleState& state, std::vector<Change<char>>& changes) const noexcept -> void {
+  // a skipped node has no match up to now, its cursor moves on so that it doesn't pin the history
+  auto skip = [&grid, &state] noexcept {
+    if (state.cursor) *state.cursor = grid.history.size();
+  };
+
+  // no match appeared since the last failure if none of the symbols read by the rules was written
+  if (state.failed_at and not grid.written_since(alphabet, *state.failed_at)) return skip();
+
+  // observations and trajectories may write by themselves, random and distance nodes only write matches
+  auto predicted = inference == Inference::RANDOM
+                or inference == Inference::DISTANCE
+                or (state.future and not state.pending.valid() and stdr::empty(state.trajectory));
+  if (predicted and unmatchable(grid)) return skip();
+
+  if (not predict(grid, state, changes)) return;
+  if (follow(grid, state, changes)) return;
+  scan(grid, state);
+  state.failed_at = stdr::empty(state.matches) ? std::optional{ grid.history.size() } : std::nullopt;
+  infer(grid, state);
+  select(state);
+  apply(grid, state, changes);
+}
 
-auto RuleNode::operator()(const TracedGrid<char>& grid, std::vector<Change<char>>& changes) noexcept -> void {
-  if (not predict(grid, changes)) return;
-  scan(grid);
-  infer(grid);
-  select();
-  apply(grid, changes);
+auto RuleNode::retain(std::vector<RewriteRule>&& _rules, std::vector<stk::u16>&& _origins) noexcept -> void {
+  rules    = std::move(_rules);
+  origins  = std::move(_origins);
+  alphabet = input_alphabet(rules);
+  required = required_symbols(rules);
 }
 
-auto RuleNode::reset() noexcept -> void {
+auto RuleState::reset() noexcept -> void {
+  // requests the search to stop and joins it
+  worker = {};
+  pending = {};
+
   potentials.clear();
   future = std::nullopt;
+  rewrites.clear();
   trajectory.clear();
+  followed = 0;
+  rng = Xoshiro256{ rngseed };
+  draws = 0;
   matches.clear();
-  active = std::ranges::begin(matches);
-  prev = {};
+  active = 0;
+  cursor = nullptr;
+  failed_at = {};
+}
+
+auto RuleNode::unmatchable(const TracedGrid<char>& grid) const noexcept -> bool {
+  return stdr::all_of(required, [&grid](const auto& sets) noexcept {
+    return stdr::any_of(sets, [&grid](const auto& set) noexcept {
+      return stdr::none_of(set, std::bind_front(&TracedGrid<char>::count, &grid));
+    });
+  });
+}
+
+auto RuleState::seed(stk::u64 s) noexcept -> void {
+  rngseed = s;
+  rng = Xoshiro256{ rngseed };
+  draws = 0;
+}
+
+auto RuleState::waiting() const noexcept -> bool {
+  return pending.valid();
+}
+
+auto RuleState::wait(std::chrono::milliseconds timeout) const noexcept -> void {
+  if (pending.valid()) pending.wait_for(timeout);
+}
+
+auto RuleState::searching() const noexcept -> const Search::Progress* {
+  return waiting() ? progress.get() : nullptr;
 }
 
 template <typename ...T>
@@ -54,118 +170,200 @@ struct std::hash<std::tuple<T...>> {
   }
 };
 
-auto RuleNode::scan(const TracedGrid<char>& grid) noexcept -> void {
-  auto now = stdr::cend(grid.history);
-  auto since = prev
-    .transform(std::bind_front(stdr::next, stdr::cbegin(grid.history)))
-    .value_or(now);
-
-  matches.erase(
-    stdr::begin(stdr::remove_if(
-      matches, std::not_fn(std::bind_back(&Match::match, std::cref(grid)))
-    )),
-    stdr::end(matches)
-  );
+auto RuleNode::scan(TracedGrid<char>& grid, RuleState& state) const noexcept -> void {
+  const auto now = grid.history.size();
+  auto& matches = state.matches;
 
-  auto history = stdr::subrange(since, now) | stdr::to<std::vector>();
+  // the node may be shared by several instances and the state may have moved since the last scan
+  matches.rules   = rules;
+  matches.extents = grid.extents;
+  matches.filter(grid);
 
-  matches.append_range(Match::scan(grid, rules, history));
+  if (not state.cursor) {
+    matches.scan(grid);
+    state.cursor = grid.history.cursor(now);
+  }
+  else if (*state.cursor != now) {
+    matches.scan(grid, grid.history.since(*state.cursor, state.recent));
+  }
+  // matches are now up to date, whether or not the node applies any of them
+  *state.cursor = now;
 
-  active = stdr::begin(matches);
+  state.active = 0;
 }
 
-auto RuleNode::apply(const TracedGrid<char>& grid, std::vector<Change<char>>& changes) -> void {
-  if (active != stdr::end(matches))
-    prev = stdr::size(grid.history);
-
-  changes.append_range(
-    stdr::subrange(active, stdr::cend(matches))
-      | stdv::transform(std::bind_back(&Match::changes, std::cref(grid)))
-      | stdv::join
-  );
+auto RuleNode::apply(const TracedGrid<char>& grid, RuleState& state, std::vector<Change<char>>& changes) const -> void {
+  for (auto k = state.active; k < stdr::size(state.matches); ++k) {
+    state.matches[k].changes(grid, changes);
+  }
 
-  matches.erase(active, stdr::end(matches));
+  state.matches.truncate(state.active);
 }
 
-auto RuleNode::predict(const Grid<char>& grid, std::vector<Change<char>>& changes) noexcept -> bool {
+auto RuleNode::predict(const TracedGrid<char>& grid, RuleState& state, std::vector<Change<char>>& changes) const noexcept -> bool {
   switch (inference) {
     case Inference::RANDOM:
       return true;
 
     case Inference::DISTANCE:
-      Field::potentials(fields, grid, potentials);
-      if (Field::essential_missing(fields, potentials)) {
+      if (Field::essential_absent(fields, state.potentials, grid)) {
+        return false;
+      }
+
+      Field::potentials(fields, grid, state.potentials);
+      if (Field::essential_missing(fields, state.potentials)) {
         return false;
       }
 
       return true;
 
     case Inference::OBSERVE:
-      if (future) {
+      if (state.future) {
         return true;
       }
 
-      Observe::future(changes, future, grid, observes);
-      if (not future) {
+      if (Observe::absent(observes, grid)) {
+        return false;
+      }
+
+      Observe::future(changes, state.future, grid, observes);
+      if (not state.future) {
         return false;
       }
 
-      Observe::backward_potentials(potentials, *future, rules);
+      Observe::backward_potentials(state.potentials, *state.future, rules);
 
       return true;
 
     case Inference::SEARCH:
-      if (future) {
+      if (state.pending.valid()) {
+        if (state.pending.wait_for(std::chrono::seconds{ 0 }) != std::future_status::ready) {
+          return false;
+        }
+
+        state.trajectory = state.pending.get();
+        state.worker = {};
+
+        if (stdr::empty(state.trajectory)) {
+          ilog("can't find trajectory to future");
+        }
+
+        return observed(state, changes);
+      }
+
+      if (state.future) {
         return true;
       }
 
-      Observe::future(changes, future, grid, observes);
-      if (not future) {
+      if (Observe::absent(observes, grid)) {
         return false;
       }
 
-      auto TRIES = limit < 0 ? 1 : 20;
-      for (auto k = 0; k < TRIES && stdr::empty(trajectory); k++) {
-        Search::trajectory(trajectory, *future, grid, rules, mode == Mode::ALL, limit, depthCoefficient);
+      // the observed values are only replaced along with the first step, the grid stays as is while searching
+      state.rewrites.clear();
+      Observe::future(state.rewrites, state.future, grid, observes);
+      if (not state.future) {
+        return false;
       }
 
-      if (stdr::empty(trajectory)) {
-        ilog("can't find trajectory to future");
+      // search is deterministic, trying again would find the same thing
+      launch(grid, state);
+
+      return not state.pending.valid() and observed(state, changes);
+  }
+}
+
+auto RuleNode::observed(RuleState& state, std::vector<Change<char>>& changes) const noexcept -> bool {
+  // the first state of a trajectory already holds the observed values, they're only written without one
+  if (stdr::empty(state.trajectory)) changes.append_range(state.rewrites);
+  state.rewrites.clear();
+  return true;
+}
+
+auto RuleNode::launch(const Grid<char>& grid, RuleState& state) const noexcept -> void {
+  // the search starts from the grid once the observed values are replaced
+  auto start = Grid<char>{ grid };
+  for (auto c : state.rewrites) start.values[c.i] = c.value;
+
+  auto key = TrajectoryCache::key(start, *state.future, rules, mode == Mode::ALL, search);
+  if (auto cached = TrajectoryCache::instance().find(key, start); cached) {
+    state.trajectory = std::move(*cached);
+    if (stdr::empty(state.trajectory)) {
+      ilog("can't find trajectory to future (cached)");
+    }
+    return;
+  }
+
+  state.progress->expanded.store(0);
+  state.progress->best.store(std::numeric_limits<double>::infinity());
+
+  auto promise = std::promise<Trajectory>{};
+  state.pending = promise.get_future();
+
+  // the rules outlive the worker, it is joined before the state and the instance sharing them go away
+  state.worker = std::jthread{
+    [search = search, goal = Future{ *state.future }, start = std::move(start),
+     rules = std::span<const RewriteRule>{ rules }, all = mode == Mode::ALL,
+     key, progress = state.progress.get(), promise = std::move(promise)]
+    (std::stop_token stop) mutable noexcept {
+      auto result = Trajectory{};
+      search.trajectory(result, goal, start, rules, all, stop, progress);
+      // an interrupted search didn't fail
+      if (not stop.stop_requested()) {
+        TrajectoryCache::instance().insert(key, start, result);
       }
+      promise.set_value(std::move(result));
+    }
+  };
+}
 
-      return true;
+auto RuleNode::follow(const Grid<char>& grid, RuleState& state, std::vector<Change<char>>& changes) const noexcept -> bool {
+  const auto& trajectory = state.trajectory;
+  if (stdr::empty(trajectory)) return false;
+  // the node is done once the future is reached
+  if (state.followed == stdr::size(trajectory)) return true;
+
+  const auto& next = trajectory[state.followed++];
+  for (auto i = 0uz; i < stdr::size(next.values); ++i) {
+    if (next.values[i] != grid.values[i]) {
+      changes.emplace_back(static_cast<stk::u32>(i), next.values[i]);
+    }
   }
+
+  return true;
 }
 
-auto RuleNode::select() noexcept -> void {
+auto RuleNode::select(RuleState& state) const noexcept -> void {
+  auto& matches = state.matches;
+  auto& active  = state.active;
+
   switch (mode) {
     case Mode::ONE:
-      if (auto picked = pick(active, stdr::end(matches));
-               picked != stdr::end(matches)
+      if (auto picked = pick(state, active, stdr::size(matches));
+               picked != stdr::size(matches)
       ) {
-        active = stdr::prev(stdr::end(matches));
-        std::iter_swap(picked, active);
+        active = stdr::size(matches) - 1;
+        matches.swap(picked, active);
       }
       else {
-        active = stdr::end(matches);
+        active = stdr::size(matches);
       }
       break;
 
     case Mode::ALL:
-      for (auto selection = stdr::end(matches);
+      for (auto selection = stdr::size(matches);
                 selection != active;
       ) {
-        if (auto picked = pick(active, selection);
+        if (auto picked = pick(state, active, selection);
                  picked != selection
         ) {
           auto conflict = stdr::any_of(
-            selection, stdr::end(matches),
-            std::bind_back(&Match::conflict, *picked)
-          );
-          std::iter_swap(
-            picked,
-            conflict ? active++ : --selection
+            stdv::iota(selection, stdr::size(matches)),
+            [candidate = matches[picked], &matches](auto k) noexcept {
+              return candidate.conflict(matches[k]);
+            }
           );
+          matches.swap(picked, conflict ? active++ : --selection);
         }
         else {
           active = selection;
@@ -173,65 +371,80 @@ auto RuleNode::select() noexcept -> void {
       }
       break;
 
-    case Mode::PRL:
-      active = stdr::begin(stdr::partition(
-        active, stdr::end(matches),
-        std::not_fn([this](const auto& match) noexcept {
-          return rules[match.r].draw(rng);
-        })
-      ));
+    case Mode::PRL: {
+      // a match's draw only depends on the step, its rule and its cell, not on the scan order
+      auto draw = CounterRng{ derive(state.rngseed, state.draws++) };
+      active = matches.partition(active, [this, &matches, &draw](auto k) noexcept {
+        auto r = matches.ruleids[k];
+        return not CounterRng{ draw(static_cast<stk::u64>(origins[r])) }
+          .bernoulli(matches.cells[k], rules[r].draw.p());
+      });
       break;
+    }
   }
 }
 
-auto RuleNode::pick(MatchIterator begin, MatchIterator end) noexcept -> MatchIterator {
-  auto weights =
-    stdr::subrange(begin, end)
-      | stdv::transform(&Match::w);
+auto RuleNode::pick(RuleState& state, std::size_t begin, std::size_t end) const noexcept -> std::size_t {
+  if (begin == end) return end;
 
-  if (stdr::fold_left(weights, 0.0, std::plus{}) == 0.0) {
+  // standard distributions differ between libraries, draws go through uniform() so seeds replay everywhere
+  const auto& matches = state.matches;
+  if (stdr::empty(matches.weights)) {
+    return std::min(begin + static_cast<std::size_t>(uniform(state.rng()) * static_cast<double>(end - begin)), end - 1);
+  }
+
+  auto weights = stdr::subrange(
+    stdr::begin(matches.weights) + static_cast<std::ptrdiff_t>(begin),
+    stdr::begin(matches.weights) + static_cast<std::ptrdiff_t>(end)
+  );
+
+  const auto total = stdr::fold_left(weights, 0.0, std::plus{});
+  if (total == 0.0) {
     return end;
   }
 
-  auto picker = std::discrete_distribution{ stdr::cbegin(weights), stdr::cend(weights) };
+  // cumulative search, the last positive weight takes what rounding leaves over
+  auto target = uniform(state.rng()) * total;
+  auto picked = end;
+  for (auto&& [k, w] : stdv::zip(stdv::iota(begin, end), weights)) {
+    if (w <= 0.0) continue;
+    picked = k;
+    if (target < w) break;
+    target -= w;
+  }
 
-  return stdr::next(begin, picker(rng));
+  return picked;
 }
 
-auto RuleNode::infer(const Grid<char>& grid) noexcept -> void {
-  if (stdr::empty(potentials)) return;
-  
+auto RuleNode::infer(const Grid<char>& grid, RuleState& state) const noexcept -> void {
+  if (stdr::empty(state.potentials)) return;
+
+  auto& matches = state.matches;
+  auto& active  = state.active;
+
+  matches.weigh();
+  auto& weights = matches.weights;
+
   auto min_w = std::numeric_limits<double>::infinity();
 
-  stdr::for_each(
-    active, stdr::end(matches),
-    [&potentials = potentials, &grid, &min_w](auto& m) mutable noexcept {
-      m.w = m.delta(grid, potentials);
-      if (is_normal(m.w)) {
-        min_w = std::min(min_w, m.w);
-      }
-  });
+  for (auto k = active; k < stdr::size(matches); ++k) {
+    weights[k] = matches[k].delta(grid, state.potentials);
+    if (is_normal(weights[k])) {
+      min_w = std::min(min_w, weights[k]);
+    }
+  }
 
-  active = stdr::begin(stdr::partition(
-    active, stdr::end(matches),
-    std::not_fn(is_normal),
-    &Match::w
-  ));
+  active = matches.partition(active, [&weights](auto k) noexcept {
+    return not is_normal(weights[k]);
+  });
 
   if (temperature <= 0.0)
-    stdr::for_each(
-      active, stdr::end(matches),
-      [](auto& m) noexcept {
-        m.w = m.w * 0.001;
-      }
-    );
+    for (auto k = active; k < stdr::size(matches); ++k) {
+      weights[k] = weights[k] * 0.001;
+    }
   else
-    stdr::for_each(
-      active, stdr::end(matches),
-      [min_w, &temperature = temperature]
-      (auto& m) noexcept {
-        /** Boltzmann Softmax distribution */
-        m.w = std::exp(-(m.w - min_w) / temperature);
-      }
-    );
+    for (auto k = active; k < stdr::size(matches); ++k) {
+      /** Boltzmann Softmax distribution */
+      weights[k] = std::exp(-(weights[k] - min_w) / temperature);
+    }
 }
@@ -1,6 +1,7 @@
 module engine.search;
 
 import geometry;
+import symmetry;
 
 import engine.match;
 
@@ -18,142 +19,459 @@ struct std::hash<Grid<char>::Extents> {
   }
 };
 
-template <typename T>
-struct std::hash<std::vector<T>> {
-  constexpr auto operator()(const std::vector<T>& t) const noexcept -> std::size_t {
-    auto s = std::size_t{ 0 };
-    auto h = std::hash<char>{};
-    for (auto c : t)
-      s ^= h(c);
-    return s;
-  }
-};
-
 template <>
 struct std::hash<Grid<char>> {
   constexpr auto operator()(const Grid<char>& grid) const noexcept -> std::size_t {
-    return std::hash<decltype(grid.extents)>{}(grid.extents)
-         ^ std::hash<decltype(grid.values)>{}(grid.values);
+    // FNV-1a, states of a search are mostly permutations of each other
+    auto h = std::size_t{ 14695981039346656037ull };
+    for (auto c : grid.values) {
+      h ^= static_cast<unsigned char>(c);
+      h *= std::size_t{ 1099511628211ull };
+    }
+    return h ^ std::hash<decltype(grid.extents)>{}(grid.extents);
   }
 };
 
+struct Estimate {
+  double backward, forward;
+};
+
+/** Heuristics of a state, or nothing when the future can't be reached from it */
+static auto estimate(
+  const Potentials& backward, Potentials& forward,
+  const Future& future, const Grid<char>& state,
+  std::span<const RewriteRule> rules
+) noexcept -> std::optional<Estimate> {
+  auto backward_estimate = Search::backward_delta(backward, state);
+  if (backward_estimate < 0.0) {
+    return std::nullopt;
+  }
+
+  Search::forward_potentials(forward, state, rules);
+  auto forward_estimate = Search::forward_delta(forward, future);
+  if (forward_estimate < 0.0) {
+    return std::nullopt;
+  }
+
+  return Estimate{ backward_estimate, forward_estimate };
+}
+
+static auto expanding(Search::Progress* progress) noexcept -> void {
+  if (progress == nullptr) return;
+  progress->expanded.fetch_add(1, std::memory_order_relaxed);
+}
+
+static auto estimated(Search::Progress* progress, const Estimate& e) noexcept -> void {
+  if (progress == nullptr) return;
+  auto h    = e.backward + e.forward;
+  auto best = progress->best.load(std::memory_order_relaxed);
+  while (h < best and not progress->best.compare_exchange_weak(best, h, std::memory_order_relaxed));
+}
+
+using Permutation = std::vector<stk::u32>;
+
+/** Cell permutations of the square symmetries, other than identity, preserving both the future and the rule set */
+static auto invariants(const Future& future, std::span<const RewriteRule> rules) noexcept -> std::vector<Permutation> {
+  const auto indices = Grid<stk::u32>{
+    std::from_range,
+    stdv::iota(stk::u32{ 0 }, static_cast<stk::u32>(stdr::size(future.values))),
+    future.extents
+  };
+
+  return stdv::zip(square_groups<Future>, square_groups<RewriteRule>, square_groups<Grid<stk::u32>>)
+    | stdv::drop(1)
+    | stdv::filter([&future, &rules](const auto& g) noexcept {
+        const auto& on_rule = std::get<1>(g);
+        return std::get<0>(g)(future) == future
+           and stdr::all_of(rules, [&rules, &on_rule](const auto& rule) noexcept {
+                 return stdr::contains(rules, on_rule(rule));
+               });
+    })
+    | stdv::transform([&indices](const auto& g) noexcept {
+        return std::get<2>(g)(indices).values;
+    })
+    | stdr::to<std::vector>();
+}
+
+/** Smallest image of a state by the given symmetries */
+static auto canonicalized(const Grid<char>& state, std::span<const Permutation> symmetries) noexcept -> Grid<char> {
+  auto result = auto{ state };
+  auto image  = std::vector<char>(stdr::size(state.values));
+  for (const auto& permutation : symmetries) {
+    stdr::transform(permutation, stdr::begin(image), [&state](auto i) noexcept {
+      return state.values[i];
+    });
+    if (stdr::lexicographical_compare(image, result.values)) {
+      stdr::swap(image, result.values);
+    }
+  }
+  return result;
+}
+
 auto Search::trajectory(
   Trajectory& traj,
   const Future& future,
   const Grid<char>& grid,
   std::span<const RewriteRule> rules,
-  bool all, stk::u32 limit, double depthCoefficient
-) -> void {
-  // traj = {};
-  auto candidates = std::vector<Candidate>{};
+  bool all, std::stop_token stop, Progress* progress
+) const -> void {
+  switch (strategy) {
+    case Strategy::BEST_FIRST: best_first(traj, future, grid, rules, all, stop, progress); break;
+    case Strategy::BEAM:       beam(traj, future, grid, rules, all, stop, progress);       break;
+    case Strategy::IDA:        ida(traj, future, grid, rules, all, stop, progress);        break;
+  }
+}
 
+auto Search::best_first(
+  Trajectory& traj,
+  const Future& future,
+  const Grid<char>& grid,
+  std::span<const RewriteRule> rules,
+  bool all, std::stop_token stop, Progress* progress
+) const -> void {
   Potentials backward, forward;
 
   Observe::backward_potentials(backward, future, rules);
-  Search::forward_potentials(forward, grid, rules);
-  
-  candidates.emplace_back(
-    auto{ grid }, -1, 0,
-    Search::backward_delta(backward, grid),
-    Search::forward_delta(forward, future) 
-  );
 
-  if (candidates[0].backward < 0.0 or candidates[0].forward < 0.0) {
-    // traj = {};
-    return;
-  }
-  if (candidates[0].backward == 0.0) {
-    // traj = {};
+  auto root = estimate(backward, forward, future, grid, rules);
+  if (not root or root->backward == 0.0) {
     return;
   }
 
-  auto visited = stdv::zip(
-    candidates | stdv::transform([](const auto& c) static noexcept { return auto{ c.state }; }),
-    stdv::iota(std::size_t{ 0u })
-  )
-    | stdr::to<std::unordered_map>();
-
-  for (
-    auto q = stdv::zip(
-      candidates | stdv::transform(std::bind_back(&Candidate::weight, depthCoefficient)),
-      stdv::iota(0u)
-    )
-      | stdr::to<std::priority_queue>([](const auto& a, const auto& b){
-          return std::get<0>(a) - std::get<0>(b);
-      });
-    not stdr::empty(q) and (limit == 0 or stdr::size(candidates) < limit);
-    q.pop()
+  // children are generated from their parent, which must not move meanwhile
+  auto candidates = std::deque<Candidate>{};
+  candidates.emplace_back(
+    auto{ grid }, Candidate::NO_PARENT, 0,
+    root->backward, root->forward
+  );
+
+  const auto symmetries = canonical ? invariants(future, rules) : std::vector<Permutation>{};
+
+  auto visited = std::unordered_map<Grid<char>, std::size_t>{};
+  visited.emplace(canonicalized(grid, symmetries), 0);
+
+  using Entry = std::tuple<double, std::size_t>;
+  auto q = std::priority_queue<Entry, std::vector<Entry>, std::greater<>>{};
+  q.emplace(candidates[0].weight(depthCoefficient), 0);
+
+  auto goal = std::optional<std::size_t>{};
+  while (not goal
+     and not stdr::empty(q)
+     and (limit == 0 or stdr::size(candidates) < limit)
   ) {
-    auto [score, parentIndex]  = q.top();
-    const auto& parent = candidates[parentIndex];
+    if (stop.stop_requested()) {
+      return;
+    }
+
+    auto [score, parentIndex] = q.top();
+    q.pop();
+    expanding(progress);
 
-    for (auto& childState : parent.children(rules, all)) {
-      if (visited.contains(childState)) {
-        auto childIndex = visited.at(childState);
+    auto parentDepth = candidates[parentIndex].depth;
+    for (auto&& childState : candidates[parentIndex].children(rules, all, backward)) {
+      auto childKey = canonicalized(childState, symmetries);
+      if (visited.contains(childKey)) {
+        auto childIndex = visited.at(childKey);
 
         auto& child = candidates[childIndex];
-        if (child.depth <= parent.depth + 1) {
+        // a symmetric image isn't a successor of this parent, the trajectory can't go through it from here
+        if (child.depth <= parentDepth + 1 or child.state != childState) {
           continue;
         }
-        
-        child.depth = parent.depth + 1;
-        child.parentIndex = parentIndex;
 
-        if (child.backward < 0.0 or child.forward < 0.0) {
-          continue;
-        }
+        child.depth = parentDepth + 1;
+        child.parentIndex = parentIndex;
 
         q.emplace(child.weight(depthCoefficient), childIndex);
       }
       else {
-        auto backward_estimate = Search::backward_delta(backward, childState);
-        Search::forward_potentials(forward, childState, rules);
-        auto forward_estimate  = Search::forward_delta(forward, future);
-        if (backward_estimate < 0.0 or forward_estimate < 0.0) {
+        auto e = estimate(backward, forward, future, childState, rules);
+        if (not e) {
           continue;
         }
+        estimated(progress, *e);
 
         auto childIndex = stdr::size(candidates);
-        visited.emplace(auto{ childState }, childIndex);
+        visited.emplace(std::move(childKey), childIndex);
         candidates.emplace_back(
-          auto{ childState },
-          parentIndex, parent.depth + 1,
-          backward_estimate, forward_estimate
+          std::move(childState),
+          parentIndex, parentDepth + 1,
+          e->backward, e->forward
         );
 
-        auto& child = candidates[childIndex];
+        if (e->forward == 0.0) {
+          goal = childIndex;
+          break;
+        }
+
+        q.emplace(candidates[childIndex].weight(depthCoefficient), childIndex);
+      }
+    }
+  }
+
+  if (not goal) {
+    return;
+  }
+
+  auto path = Trajectory{};
+  for (auto i = *goal;
+       candidates[i].parentIndex != Candidate::NO_PARENT;
+       i = candidates[i].parentIndex
+  ) {
+    path.push_back(std::move(candidates[i].state));
+  }
+  traj.append_range(path | stdv::reverse | stdv::as_rvalue);
+}
+
+auto Search::beam(
+  Trajectory& traj,
+  const Future& future,
+  const Grid<char>& grid,
+  std::span<const RewriteRule> rules,
+  bool all, std::stop_token stop, Progress* progress
+) const -> void {
+  Potentials backward, forward;
+
+  Observe::backward_potentials(backward, future, rules);
+
+  auto root = estimate(backward, forward, future, grid, rules);
+  if (not root or root->backward == 0.0) {
+    return;
+  }
+
+  const auto beam_width = std::max(width, stk::u32{ 1 });
+  const auto symmetries = canonical ? invariants(future, rules) : std::vector<Permutation>{};
+
+  // only the kept layer and the one being built are deduplicated, so memory doesn't grow with the depth
+  auto kept   = std::unordered_set<Grid<char>>{};
+  kept.insert(canonicalized(grid, symmetries));
+  auto layers = std::vector<std::vector<Candidate>>{};
+  layers.emplace_back().emplace_back(
+    auto{ grid }, Candidate::NO_PARENT, 0,
+    root->backward, root->forward
+  );
+
+  auto goal = std::optional<std::size_t>{};
+  while (not goal and (limit == 0 or stdr::size(layers) <= limit)) {
+    auto next  = std::vector<Candidate>{};
+    auto fresh = std::unordered_set<Grid<char>>{};
+
+    const auto& layer = layers.back();
+    for (auto parentIndex = std::size_t{ 0 };
+         not goal and parentIndex < stdr::size(layer);
+         ++parentIndex
+    ) {
+      if (stop.stop_requested()) {
+        return;
+      }
+      expanding(progress);
+
+      for (auto&& childState : layer[parentIndex].children(rules, all, backward)) {
+        auto key = canonicalized(childState, symmetries);
+        if (kept.contains(key) or not fresh.insert(std::move(key)).second) {
+          continue;
+        }
+
+        auto e = estimate(backward, forward, future, childState, rules);
+        if (not e) {
+          continue;
+        }
+        estimated(progress, *e);
+
+        next.emplace_back(
+          std::move(childState),
+          parentIndex, layer[parentIndex].depth + 1,
+          e->backward, e->forward
+        );
 
-        if (child.forward == 0.0) {
-          q = {}; // end the propagation
+        if (e->forward == 0.0) {
+          goal = stdr::size(next) - 1;
           break;
         }
+      }
+    }
 
-        // if (limit == 0 and backward_estimate + forward_estimate <= record) {
-        //   record = backward_estimate + forward_estimate;
-        // }
+    if (stdr::empty(next)) {
+      return;
+    }
 
-        q.emplace(child.weight(depthCoefficient), childIndex);
+    if (not goal and stdr::size(next) > beam_width) {
+      stdr::nth_element(
+        next, stdr::next(stdr::begin(next), beam_width), {},
+        [](const auto& c) static noexcept { return c.backward + c.forward; }
+      );
+      next.erase(stdr::next(stdr::begin(next), beam_width), stdr::end(next));
+    }
+
+    kept.clear();
+    for (const auto& candidate : next) {
+      kept.insert(canonicalized(candidate.state, symmetries));
+    }
+    layers.push_back(std::move(next));
+  }
+
+  if (not goal) {
+    return;
+  }
+
+  auto path = Trajectory{};
+  auto i = *goal;
+  for (auto depth = stdr::size(layers) - 1; depth > 0; --depth) {
+    path.push_back(std::move(layers[depth][i].state));
+    i = layers[depth][i].parentIndex;
+  }
+  traj.append_range(path | stdv::reverse | stdv::as_rvalue);
+}
+
+/** Depth first search bounded by the weight of its states, only the current path is stored */
+struct Deepening {
+  const Potentials& backward;
+  Potentials&       forward;
+
+  const Future& future;
+  std::span<const RewriteRule> rules;
+  bool all;
+
+  double   depthCoefficient;
+  stk::u32 limit;
+
+  std::span<const Permutation> symmetries;
+
+  std::stop_token   stop;
+  Search::Progress* progress;
+
+  std::deque<Candidate>           path     = {};
+  std::unordered_set<Grid<char>>  onpath   = {};
+  stk::u32                        expanded = 0;
+  bool                            exhausted = false;
+
+  double bound = 0.0, next_bound = 0.0;
+
+  auto dive() -> bool {
+    const auto w = path.back().weight(depthCoefficient);
+    if (w > bound) {
+      next_bound = std::min(next_bound, w);
+      return false;
+    }
+
+    if (path.back().forward == 0.0) {
+      return true;
+    }
+
+    if (stop.stop_requested() or (limit != 0 and expanded >= limit)) {
+      exhausted = true;
+      return false;
+    }
+    ++expanded;
+    expanding(progress);
+
+    const auto parentIndex = stdr::size(path) - 1;
+    const auto depth       = path.back().depth;
+    for (auto&& childState : path.back().children(rules, all, backward)) {
+      auto key = canonicalized(childState, symmetries);
+      if (onpath.contains(key)) {
+        continue;
       }
+
+      auto e = estimate(backward, forward, future, childState, rules);
+      if (not e) {
+        continue;
+      }
+      estimated(progress, *e);
+
+      path.emplace_back(
+        std::move(childState),
+        parentIndex, depth + 1,
+        e->backward, e->forward
+      );
+      onpath.insert(auto{ key });
+
+      if (dive()) {
+        return true;
+      }
+      if (exhausted) {
+        return false;
+      }
+
+      onpath.erase(key);
+      path.pop_back();
     }
+
+    return false;
   }
+};
 
-  if (stdr::empty(candidates)
-   or stdr::prev(stdr::cend(candidates))->forward != 0.0
-  ) {
-    // traj = {};
+auto Search::ida(
+  Trajectory& traj,
+  const Future& future,
+  const Grid<char>& grid,
+  std::span<const RewriteRule> rules,
+  bool all, std::stop_token stop, Progress* progress
+) const -> void {
+  Potentials backward, forward;
+
+  Observe::backward_potentials(backward, future, rules);
+
+  auto root = estimate(backward, forward, future, grid, rules);
+  if (not root or root->backward == 0.0) {
     return;
   }
 
-  // TODO use child.depth to resize traj
-  for (auto candidate = stdr::prev(stdr::cend(candidates));
-       candidate->parentIndex >= 0;
-       candidate = stdr::next(stdr::cbegin(candidates), candidate->parentIndex)
-  ) {
-    traj.emplace(stdr::begin(traj), std::move(candidate->state));
+  const auto symmetries = canonical ? invariants(future, rules) : std::vector<Permutation>{};
+
+  auto search = Deepening{
+    backward, forward,
+    future, rules, all,
+    depthCoefficient, limit,
+    symmetries,
+    stop, progress
+  };
+  search.path.emplace_back(
+    auto{ grid }, Candidate::NO_PARENT, 0,
+    root->backward, root->forward
+  );
+  search.onpath.insert(canonicalized(grid, symmetries));
+  search.bound = search.path[0].weight(depthCoefficient);
+
+  for (;;) {
+    search.next_bound = std::numeric_limits<double>::infinity();
+    if (search.dive()) {
+      break;
+    }
+    if (search.exhausted or std::isinf(search.next_bound)) {
+      return;
+    }
+    search.bound = search.next_bound;
   }
+
+  traj.append_range(
+    search.path
+      | stdv::drop(1)
+      | stdv::transform(&Candidate::state)
+      | stdv::as_rvalue
+  );
 }
 
 auto Search::forward_potentials(Potentials& potentials, const Grid<char>& grid, std::span<const RewriteRule> rules) noexcept -> void {
+  static constexpr auto NaN = std::numeric_limits<double>::quiet_NaN();
+
+  for (auto& potential : potentials | stdv::values) {
+    stdr::fill(potential.values, NaN);
+  }
+
+  // every symbol that can be written needs a potential
+  auto ensure = [&potentials, &extents = grid.extents](char c) noexcept {
+    if (not potentials.contains(c)) {
+      potentials.emplace(c, Potential{ extents, NaN });
+    }
+  };
+  stdr::for_each(grid, ensure);
+  for (const auto& rule : rules) {
+    for (const auto& o : rule.output) {
+      if (o) ensure(*o);
+    }
+  }
+
   propagate(
     stdv::zip(mdiota(grid.area()), grid)
       | stdv::transform([&potentials](const auto& p) noexcept {
@@ -161,15 +479,23 @@ auto Search::forward_potentials(Potentials& potentials, const Grid<char>& grid,
           potentials.at(c)[u] = 0.0;
           return std::tuple{ u, c };
       }),
-    [&potentials, &rules](auto&& front) noexcept {
+    [&potentials, &rules, g_area = grid.area()](auto&& front) noexcept {
       auto [u, c] = front;
       auto p = potentials.at(c)[u];
       return stdv::iota(0u, stdr::size(rules))
-        | stdv::transform([&rules, u](auto r) noexcept {
-            return Match{ rules, u, r };
+        | stdv::transform([&rules, u, c](auto r) noexcept {
+            return rules[r].ishifts(c)
+              | stdv::transform([&rules, u, r](auto shift) noexcept {
+                  return Match{ rules, u - shift, r };
+              });
+        })
+        | stdv::join
+        | stdv::filter([g_area](const auto& m) noexcept {
+            auto ru_area = m.rules[m.r].bounds + m.u;
+            return g_area.meet(ru_area) == ru_area;
         })
-        | stdv::filter(std::bind_back(&Match::forward_match, potentials, p))
-        | stdv::transform(std::bind_back(&Match::forward_changes, potentials, p + 1))
+        | stdv::filter(std::bind_back(&Match::forward_match, std::cref(potentials), p))
+        | stdv::transform(std::bind_back(&Match::forward_changes, std::cref(potentials), p + 1))
         | stdv::join
         | stdv::transform([&potentials](auto&& ch) noexcept {
             auto [c, p] = ch.value;
@@ -181,43 +507,33 @@ auto Search::forward_potentials(Potentials& potentials, const Grid<char>& grid,
 }
 
 auto Search::backward_delta(const Potentials& potentials, const Grid<char>& grid) noexcept -> double {
-  auto vals = stdv::zip(mdiota(grid.area()), grid)
-    | stdv::transform([&potentials] (const auto& locus) noexcept {
-        auto [u, value] = locus;
-        return potentials.contains(value) ? potentials.at(value)[u]
-          : 0.0;
-    });
-  
-  return std::reduce(
-    // std::execution::par,
-    stdr::begin(vals),
-    stdr::end(vals)
-  );
+  auto sum = 0.0;
+  for (auto&& [u, value] : stdv::zip(mdiota(grid.area()), grid)) {
+    if (not potentials.contains(value)
+     or not is_normal(potentials.at(value)[u])
+    ) {
+      return -1.0;
+    }
+    sum += potentials.at(value)[u];
+  }
+  return sum;
 }
 
 auto Search::forward_delta(const Potentials& potentials, const Future& future) noexcept -> double {
-  auto vals = stdv::zip(mdiota(future.area()), future)
-    | stdv::transform([&potentials] (const auto& locus) noexcept {
-        auto [u, value] = locus;
-        if (stdr::empty(value)) {
-          return std::numeric_limits<double>::quiet_NaN();
-        }
-
-        auto candidates = potentials
-          | stdv::transform([u] (const auto& pot){
-              const auto& [c, potential] = pot;
-              return potential[u];
-          })
-          | stdv::filter(is_normal);
-        return stdr::empty(candidates) ? std::numeric_limits<double>::quiet_NaN()
-          : stdr::min(candidates);
-    });
-  
-  return std::reduce(
-    // std::execution::par,
-    stdr::begin(vals),
-    stdr::end(vals)
-  );
+  auto sum = 0.0;
+  for (auto&& [u, value] : stdv::zip(mdiota(future.area()), future)) {
+    auto best = std::numeric_limits<double>::infinity();
+    for (auto c : value) {
+      if (potentials.contains(c) and is_normal(potentials.at(c)[u])) {
+        best = std::min(best, potentials.at(c)[u]);
+      }
+    }
+    if (std::isinf(best)) {
+      return -1.0;
+    }
+    sum += best;
+  }
+  return sum;
 }
 
 auto Candidate::weight(double depthCoefficient) const -> double {
@@ -225,57 +541,142 @@ auto Candidate::weight(double depthCoefficient) const -> double {
     : forward + backward + 2.0 * depthCoefficient * static_cast<double>(depth);
 }
 
+/** A match is a dead end when it writes a value from which the future can't be reached */
+static auto viable(const Match& m, const Potentials& backward) noexcept -> bool {
+  return stdr::all_of(
+    stdv::zip(mdiota(m.area()), m.rules[m.r].output),
+    [&backward](const auto& output) noexcept {
+      auto [u, o] = output;
+      return not o
+          or (backward.contains(*o) and is_normal(backward.at(*o)[u]));
+    }
+  );
+}
+
+/**
+ * Maximal sets of non conflicting matches, branching on the live matches that cover the most covered cell :
+ * each of them in turn is the first one chosen, the ones before it are left out, or all of them are.
+ * A match left out must conflict with a chosen one for the set to be maximal, a branch is cut as soon as
+ * none chosen or still available can. Dead ends are never chosen.
+ */
+static auto maximal_sets(
+  const Grid<char>& state,
+  const std::vector<Match>& matches,
+  Grid<stk::u32>& hits,
+  std::vector<bool>& hidden,
+  std::vector<std::size_t>& chosen,
+  std::vector<std::size_t>& excluded
+) -> std::generator<Grid<char>> {
+  const auto blockable = stdr::all_of(excluded, [&matches, &hidden, &chosen](auto m) noexcept {
+    auto blocks = [&matches, m](auto k) noexcept { return matches[m].conflict(matches[k]); };
+    return stdr::any_of(chosen, blocks)
+        or stdr::any_of(
+             stdv::iota(std::size_t{ 0 }, stdr::size(matches))
+               | stdv::filter([&hidden](auto k) noexcept { return not hidden[k]; }),
+             blocks
+           );
+  });
+  if (not blockable) co_return;
+
+  auto top = stdr::max_element(hits.values);
+  if (top == stdr::end(hits.values) or *top == 0) {
+    auto substate = auto{ state };
+    auto changes  = std::vector<Change<char>>{};
+    for (auto k : chosen) matches[k].changes(state, changes);
+    for (auto c : changes) substate.values[c.i] = c.value;
+    co_yield std::move(substate);
+    co_return;
+  }
+
+  const auto u = fromIndex(stdr::distance(stdr::begin(hits.values), top), hits.extents);
+
+  const auto cover = stdv::iota(std::size_t{ 0 }, stdr::size(matches))
+    | stdv::filter([&](auto k) noexcept {
+        return not hidden[k]
+           and matches[k].area().contains(u);
+    })
+    | stdr::to<std::vector>();
+
+  auto hide = [&hidden, &hits, &matches](auto m) noexcept {
+    hidden[m] = true;
+    for (auto v : mdiota(matches[m].area())) --hits[v];
+  };
+  auto show = [&hidden, &hits, &matches](auto m) noexcept {
+    hidden[m] = false;
+    for (auto v : mdiota(matches[m].area())) ++hits[v];
+  };
+
+  for (auto k : cover) {
+    const auto hiding = stdv::iota(std::size_t{ 0 }, stdr::size(matches))
+      | stdv::filter([&](auto m) noexcept {
+          return not hidden[m]
+             and (m == k or matches[m].conflict(matches[k]));
+      })
+      | stdr::to<std::vector>();
+
+    for (auto m : hiding) hide(m);
+    chosen.push_back(k);
+
+    co_yield stdr::elements_of(maximal_sets(state, matches, hits, hidden, chosen, excluded));
+
+    chosen.pop_back();
+    for (auto m : hiding) show(m);
+
+    // the next branches leave it out
+    hide(k);
+    excluded.push_back(k);
+  }
+
+  co_yield stdr::elements_of(maximal_sets(state, matches, hits, hidden, chosen, excluded));
+
+  for (auto k : cover) {
+    excluded.pop_back();
+    show(k);
+  }
+}
+
 // TODO maybe avoid duplication of rulenode logic ?
-auto Candidate::children(std::span<const RewriteRule> rules, bool all) const -> std::vector<Grid<char>> {
-  auto result = std::vector<Grid<char>>{};
-
-  auto matches = Match::scan(state, rules);
-
-  if (all) {
-    // all :
-    //   non overlaping matches induce a common substate when applied simultaneously
-    //   overlaping matches induce a combinatoric of substates when applied concurrently
-    //     cartesian product of the overlaping rules grouped by joined overlapping area
-    // mock:
-    auto common_substate = auto{ state };
-    stdr::for_each(
-      matches
-        | stdv::transform(std::bind_back(&Match::changes, common_substate))
-        | stdv::join,
-      [&common_substate](auto&& c) {
-        common_substate[c.u] = c.value;
-    });
-    // real :
-    // fill hitgrid (Grid<u32>)
-    // recursively enumerate while decrementing hitgrid :
-    //   find u : location of hitgrid with highest nonzero value
-    //   if none, we're done with this recursion :
-    //       apply current sequence and push result
-    result.emplace_back(std::move(common_substate));
-    //   for each match m hitting u :
-    //     recurse enumeration with :
-    //       hitgrid decremented on m.area
-    //       matches without those intersecting m
-    //       current sequence appended with m
-    //   
+auto Candidate::children(std::span<const RewriteRule> rules, bool all, const Potentials& backward) const
+-> std::generator<Grid<char>> {
+  const auto matches = Match::scan(state, rules);
+  if (stdr::empty(matches)) {
+    co_return;
   }
-  else {
+
+  const auto dead = matches
+    | stdv::transform([&backward](const auto& m) noexcept {
+        return not viable(m, backward);
+    })
+    | stdr::to<std::vector>();
+
+  if (not all) {
     // one :
     //   each match gives an induced state when applied individually
-    result.append_range(
-      matches
-        | stdv::transform([&state = state](auto&& m) {
-          auto newstate = auto{ state };
-          stdr::for_each(
-            m.changes(newstate),
-            [&newstate](auto&& c) {
-              newstate[c.u] = c.value;
-          });
-          return newstate;
-        })
-    );
+    auto changes = std::vector<Change<char>>{};
+    for (auto&& [m, d] : stdv::zip(matches, dead)) {
+      if (d) continue;
+
+      auto newstate = auto{ state };
+      changes.clear();
+      m.changes(state, changes);
+      for (auto c : changes) newstate.values[c.i] = c.value;
+      co_yield std::move(newstate);
+    }
+    co_return;
   }
 
-  return result;
-}
+  // all :
+  //   non conflicting matches are applied simultaneously, conflicting ones concurrently :
+  //   each maximal set of non conflicting matches induces a state
+  //   dead ends are hidden from the start, they neither get chosen nor need to be blocked
+  auto hits = Grid<stk::u32>{ state.extents, 0u };
+  for (auto&& [m, d] : stdv::zip(matches, dead)) {
+    if (d) continue;
+    for (auto u : mdiota(m.area())) ++hits[u];
+  }
+  auto hidden   = dead;
+  auto chosen   = std::vector<std::size_t>{};
+  auto excluded = std::vector<std::size_t>{};
 
+  co_yield stdr::elements_of(maximal_sets(state, matches, hits, hidden, chosen, excluded));
+}
@@ -5,6 +5,10 @@ import stormkit.log;
 import stormkit.core;
 import tui.consoleapp;
 import gui.windowapp;
+import cli.headlessapp;
+import cli.batchapp;
+import engine.cache;
+import config;
 
 namespace stk = stormkit;
 
@@ -13,6 +17,16 @@ constexpr auto run_consoleapp(std::span<const std::string_view> args) noexcept -
   return app(args);
 }
 
+constexpr auto run_headlessapp(std::span<const std::string_view> args) noexcept -> int {
+  auto app = HeadlessApp{};
+  return app(args);
+}
+
+constexpr auto run_batchapp(std::span<const std::string_view> args) noexcept -> int {
+  auto app = BatchApp{};
+  return app(args);
+}
+
 constexpr auto run_windowapp(std::span<const std::string_view> args) noexcept -> int {
   auto app = WindowApp{};
   return app(args);
@@ -28,10 +42,23 @@ auto main(const int argc, const char** argv) -> int {
   auto args = std::vector<std::string_view> {};
   for (auto i = 0u; i < static_cast<std::size_t>(argc); ++i) args.emplace_back(argv[i]);
 
-  auto&& gui = std::ranges::find(args, "--gui") != std::ranges::end(args);
+  auto gui      = flag(args, "gui");
+  auto headless = flag(args, "headless");
+  auto batch    = option(args, "batch").has_value();
+
+  // keeps found trajectories between runs
+  auto cachefile = option(args, "cache");
   
   auto _ = stk::log::Logger::create_logger_instance<stk::log::FileLogger>(".");
 
-  if (gui) return run_windowapp(args);
-  else     return run_consoleapp(args);
+  if (cachefile) TrajectoryCache::instance().load(*cachefile);
+
+  auto result = batch    ? run_batchapp(args)
+              : headless ? run_headlessapp(args)
+              : gui      ? run_windowapp(args)
+                         : run_consoleapp(args);
+
+  if (cachefile) TrajectoryCache::instance().save(*cachefile);
+
+  return result;
 }
@@ -0,0 +1,439 @@
+module parser.binary;
+
+import log;
+import geometry;
+import grid;
+import parser;
+
+import engine.rewriterule;
+import engine.rulenode;
+import engine.fields;
+import engine.observes;
+import engine.search;
+
+namespace stk  = stormkit;
+namespace stdr = std::ranges;
+namespace stdv = std::views;
+
+using charset = std::unordered_set<char>;
+
+using Magic = std::array<char, 4>;
+static constexpr auto MAGIC   = Magic{ 'M', 'J', 'B', 'M' };
+/** Bump whenever the layout or what the parser compiles changes */
+static constexpr auto VERSION = stk::u32{ 2 };
+
+struct Writer {
+  std::vector<std::byte> bytes = {};
+
+  template <class T>
+    requires std::is_trivially_copyable_v<T>
+  auto put(const T& v) noexcept -> void {
+    const auto* p = reinterpret_cast<const std::byte*>(&v);
+    bytes.insert(stdr::end(bytes), p, p + sizeof(T));
+  }
+
+  auto put(std::string_view s) noexcept -> void {
+    put(static_cast<stk::u32>(stdr::size(s)));
+    bytes.append_range(std::as_bytes(std::span{ s }));
+  }
+
+  /** Sorted, equal sets give equal bytes */
+  auto put(const charset& cs) noexcept -> void {
+    auto s = cs | stdr::to<std::string>();
+    stdr::sort(s);
+    put(std::string_view{ s });
+  }
+};
+
+/** Reads stop at the first missing byte, `ok` tells whether it happened */
+struct Reader {
+  std::span<const std::byte> bytes;
+  bool ok = true;
+
+  template <class T>
+    requires std::is_trivially_copyable_v<T>
+  auto get(T& v) noexcept -> void {
+    if (not ok or stdr::size(bytes) < sizeof(T)) {
+      ok = false;
+      return;
+    }
+    std::memcpy(&v, stdr::data(bytes), sizeof(T));
+    bytes = bytes.subspan(sizeof(T));
+  }
+
+  /** Only 0 and 1 are booleans */
+  auto get(bool& b) noexcept -> void {
+    auto v = stk::u8{};
+    get(v);
+    if (v > 1) ok = false;
+    b = v == 1;
+  }
+
+  auto get(std::string& s) noexcept -> void {
+    auto n = stk::u32{};
+    get(n);
+    if (not ok or stdr::size(bytes) < n) {
+      ok = false;
+      return;
+    }
+    s.assign(reinterpret_cast<const char*>(stdr::data(bytes)), n);
+    bytes = bytes.subspan(n);
+  }
+
+  auto get(charset& cs) noexcept -> void {
+    auto s = std::string{};
+    get(s);
+    cs = s | stdr::to<charset>();
+  }
+
+  template <class T>
+  auto get() noexcept -> T {
+    auto v = T{};
+    get(v);
+    return v;
+  }
+};
+
+/** Scoped enums read from the file hold one of their enumerators, up to `last` */
+template <class E>
+static auto valid(E e, E last) noexcept -> bool {
+  using U = std::make_unsigned_t<std::underlying_type_t<E>>;
+  return static_cast<U>(std::to_underlying(e)) <= static_cast<U>(std::to_underlying(last));
+}
+
+static auto put(Writer& out, const RewriteRule::Unions& unions) noexcept -> void {
+  out.put(static_cast<stk::u32>(stdr::size(unions)));
+  for (const auto& [c, values] : unions) {
+    out.put(c);
+    out.put(values);
+  }
+}
+
+static auto get(Reader& in, RewriteRule::Unions& unions) noexcept -> void {
+  for (auto _ : stdv::iota(0u, in.get<stk::u32>())) {
+    auto c = in.get<char>();
+    unions.emplace(c, in.get<charset>());
+    if (not in.ok) return;
+  }
+}
+
+static auto put(Writer& out, const RewriteRule& rule) noexcept -> void {
+  out.put(static_cast<stk::u32>(rule.input.extents.extent(0)));
+  out.put(static_cast<stk::u32>(rule.input.extents.extent(1)));
+  out.put(static_cast<stk::u32>(rule.input.extents.extent(2)));
+  for (const auto& i : rule.input) {
+    out.put(i.has_value());
+    if (i) out.put(*i);
+  }
+  for (const auto& o : rule.output) {
+    out.put(o.value_or(RewriteRule::IGNORED_SYMBOL));
+  }
+  out.put(rule.draw.p());
+  out.put(rule.is_copy);
+  out.put(rule.bounds.u);
+  out.put(rule.bounds.size);
+}
+
+static auto get(Reader& in) noexcept -> std::optional<RewriteRule> {
+  auto z = in.get<stk::u32>(), y = in.get<stk::u32>(), x = in.get<stk::u32>();
+  if (not in.ok) return std::nullopt;
+
+  // every cell takes at least a byte, a larger rule can't fit in what's left
+  auto n = stk::u64{ z } * y;
+  if (n == 0 or x == 0 or n > stdr::size(in.bytes) / x) return std::nullopt;
+  n *= x;
+  const auto extents = std::dims<3>{ z, y, x };
+
+  auto input = std::vector<RewriteRule::Input>{};
+  input.reserve(n);
+  for (auto _ : stdv::iota(0uz, n)) {
+    input.push_back(in.get<bool>() ? RewriteRule::Input{ in.get<charset>() } : std::nullopt);
+  }
+  auto output = std::vector<RewriteRule::Output>{};
+  output.reserve(n);
+  for (auto _ : stdv::iota(0uz, n)) {
+    auto o = in.get<char>();
+    output.push_back(o == RewriteRule::IGNORED_SYMBOL ? std::nullopt : RewriteRule::Output{ o });
+  }
+  auto p       = in.get<double>();
+  auto is_copy = in.get<bool>();
+  auto bounds  = Area3{ in.get<Area3::Offset>(), in.get<Area3::Size>() };
+  if (not in.ok) return std::nullopt;
+
+  // placements are clipped with the bounds, the input must be inside them
+  const auto area = Area3{ {}, Area3::Size{ x, y, z } };
+  if (bounds.meet(area) != area) return std::nullopt;
+
+  auto rule = RewriteRule{
+    { std::from_range, std::move(input), extents },
+    { std::from_range, std::move(output), extents },
+    p, is_copy
+  };
+  rule.bounds = bounds;
+  return rule;
+}
+
+static auto put(Writer& out, const RuleNode& node) noexcept -> void {
+  out.put(node.mode);
+  out.put(node.inference);
+  out.put(node.temperature);
+  out.put(node.search.strategy);
+  out.put(node.search.limit);
+  out.put(node.search.width);
+  out.put(node.search.depthCoefficient);
+  out.put(node.search.canonical);
+
+  put(out, node.unions);
+
+  out.put(static_cast<stk::u32>(stdr::size(node.fields)));
+  for (const auto& [c, field] : node.fields) {
+    out.put(c);
+    out.put(field.recompute);
+    out.put(field.essential);
+    out.put(field.inversed);
+    out.put(field.substrate);
+    out.put(field.zero);
+  }
+
+  out.put(static_cast<stk::u32>(stdr::size(node.observes)));
+  for (const auto& [c, observe] : node.observes) {
+    out.put(c);
+    out.put(observe.from.has_value());
+    out.put(observe.from.value_or(c));
+    out.put(observe.to);
+  }
+
+  out.put(static_cast<stk::u32>(stdr::size(node.rules)));
+  for (const auto& rule : node.rules) put(out, rule);
+  for (auto origin : node.origins) out.put(origin);
+}
+
+static auto get_rulenode(Reader& in) noexcept -> std::optional<RuleNode> {
+  auto mode        = in.get<RuleNode::Mode>();
+  auto inference   = in.get<RuleNode::Inference>();
+  if (not valid(mode, RuleNode::Mode::PRL) or not valid(inference, RuleNode::Inference::SEARCH)) return std::nullopt;
+  auto temperature = in.get<double>();
+  auto search      = Search{};
+  in.get(search.strategy);
+  in.get(search.limit);
+  in.get(search.width);
+  in.get(search.depthCoefficient);
+  in.get(search.canonical);
+  if (not valid(search.strategy, Search::Strategy::IDA)) return std::nullopt;
+
+  auto unions = RewriteRule::Unions{};
+  get(in, unions);
+
+  auto fields = Fields{};
+  for (auto _ : stdv::iota(0u, in.get<stk::u32>())) {
+    auto c     = in.get<char>();
+    auto field = Field{};
+    in.get(field.recompute);
+    in.get(field.essential);
+    in.get(field.inversed);
+    in.get(field.substrate);
+    in.get(field.zero);
+    if (not in.ok) return std::nullopt;
+    fields.emplace(c, std::move(field));
+  }
+
+  auto observes = Observes{};
+  for (auto _ : stdv::iota(0u, in.get<stk::u32>())) {
+    auto c        = in.get<char>();
+    auto has_from = in.get<bool>();
+    auto from     = in.get<char>();
+    auto to       = in.get<charset>();
+    if (not in.ok) return std::nullopt;
+    observes.emplace(c, Observe{ has_from ? std::optional{ from } : std::nullopt, std::move(to) });
+  }
+
+  auto rules = std::vector<RewriteRule>{};
+  for (auto _ : stdv::iota(0u, in.get<stk::u32>())) {
+    auto rule = get(in);
+    if (not rule) return std::nullopt;
+    rules.push_back(std::move(*rule));
+  }
+  auto origins = std::vector<stk::u16>(stdr::size(rules));
+  for (auto& origin : origins) in.get(origin);
+  if (not in.ok) return std::nullopt;
+
+  auto rulenode = std::optional<RuleNode>{};
+  switch (inference) {
+    case RuleNode::Inference::RANDOM:
+      rulenode.emplace(mode, std::vector<RewriteRule>{}, std::move(unions));
+      break;
+    case RuleNode::Inference::DISTANCE:
+      rulenode.emplace(mode, std::vector<RewriteRule>{}, std::move(unions), std::move(fields), temperature);
+      break;
+    case RuleNode::Inference::OBSERVE:
+      rulenode.emplace(mode, std::vector<RewriteRule>{}, std::move(unions), std::move(observes), temperature);
+      break;
+    case RuleNode::Inference::SEARCH:
+      rulenode.emplace(mode, std::vector<RewriteRule>{}, std::move(unions), std::move(observes), std::move(search));
+      break;
+  }
+  if (rulenode) rulenode->retain(std::move(rules), std::move(origins));
+  return rulenode;
+}
+
+/**
+ * The nodes form a tree flattened in preorder : a parent comes before its children, a subtree ends within
+ * its parent's, a next sibling starts where the subtree ends, and rule nodes are leaves pointing to a rule node.
+ */
+static auto consistent(std::span<const Program::Node> nodes, std::size_t rules) noexcept -> bool {
+  constexpr auto NONE = Program::NONE;
+  const auto n = stdr::size(nodes);
+  if (n == 0 or nodes[0].parent != NONE or nodes[0].next != NONE or nodes[0].end != n) return false;
+
+  for (auto i = 0uz; i < n; ++i) {
+    const auto& node = nodes[i];
+    if (node.end <= i or node.end > n) return false;
+    if (i > 0) {
+      if (node.parent >= i) return false;
+      const auto& parent = nodes[node.parent];
+      if (parent.kind == Program::Node::Kind::RULE or node.end > parent.end) return false;
+    }
+    if (node.next != NONE) {
+      if (node.next != node.end or node.next >= n or nodes[node.next].parent != node.parent) return false;
+    }
+    if (node.kind == Program::Node::Kind::RULE) {
+      if (node.end != i + 1 or node.rule >= rules) return false;
+    }
+    else if (node.rule != NONE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+namespace parser::binary {
+
+auto encode(const CompiledModel& model) noexcept -> std::vector<std::byte> {
+  auto out = Writer{};
+  out.put(MAGIC);
+  out.put(VERSION);
+
+  out.put(std::string_view{ model.symbols });
+  out.put(model.origin);
+  put(out, model.unions);
+
+  const auto& program = model.program;
+  out.put(static_cast<stk::u32>(stdr::size(program.nodes)));
+  for (const auto& node : program.nodes) {
+    out.put(node.kind);
+    out.put(static_cast<stk::u64>(node.parent));
+    out.put(static_cast<stk::u64>(node.next));
+    out.put(static_cast<stk::u64>(node.end));
+    out.put(static_cast<stk::u64>(node.rule));
+    out.put(static_cast<stk::u64>(node.steps));
+    out.put(static_cast<stk::u64>(node.order));
+  }
+
+  out.put(static_cast<stk::u32>(stdr::size(program.rules)));
+  for (const auto& rulenode : program.rules) put(out, rulenode);
+
+  return std::move(out.bytes);
+}
+
+auto decode(std::span<const std::byte> bytes) noexcept -> std::optional<CompiledModel> {
+  auto in = Reader{ bytes };
+  if (in.get<Magic>() != MAGIC or in.get<stk::u32>() != VERSION) return std::nullopt;
+
+  auto symbols = in.get<std::string>();
+  auto origin  = in.get<bool>();
+  auto unions  = RewriteRule::Unions{};
+  get(in, unions);
+
+  auto nodes = std::vector<Program::Node>{};
+  for (auto _ : stdv::iota(0u, in.get<stk::u32>())) {
+    auto kind = in.get<Program::Node::Kind>();
+    auto parent = in.get<stk::u64>(), next = in.get<stk::u64>(), end = in.get<stk::u64>();
+    auto rule = in.get<stk::u64>(), steps = in.get<stk::u64>(), order = in.get<stk::u64>();
+    if (not in.ok or not valid(kind, Program::Node::Kind::SEQUENCE)) return std::nullopt;
+    nodes.push_back(Program::Node{
+      .kind   = kind,
+      .parent = static_cast<std::size_t>(parent),
+      .next   = static_cast<std::size_t>(next),
+      .end    = static_cast<std::size_t>(end),
+      .rule   = static_cast<std::size_t>(rule),
+      .steps  = static_cast<stk::cpp::UInt>(steps),
+      .order  = static_cast<std::size_t>(order),
+    });
+  }
+
+  auto rules = std::vector<RuleNode>{};
+  for (auto _ : stdv::iota(0u, in.get<stk::u32>())) {
+    auto rulenode = get_rulenode(in);
+    if (not rulenode) return std::nullopt;
+    rules.push_back(std::move(*rulenode));
+  }
+  if (not in.ok or not consistent(nodes, stdr::size(rules))) return std::nullopt;
+  // the grid is filled with the first symbol, the origin is the second one
+  if (stdr::size(symbols) < (origin ? 2uz : 1uz)) return std::nullopt;
+
+  return CompiledModel{
+    std::move(symbols),
+    std::move(unions),
+    origin,
+    ::Program{ std::move(nodes), std::move(rules) }
+  };
+}
+
+/** The whole file in a single read */
+static auto read(const std::filesystem::path& path) noexcept -> std::vector<std::byte> {
+  auto in = std::ifstream{ path, std::ios::binary | std::ios::ate };
+  if (not in) return {};
+
+  auto bytes = std::vector<std::byte>(static_cast<std::size_t>(in.tellg()));
+  in.seekg(0);
+  if (not in.read(reinterpret_cast<char*>(stdr::data(bytes)), static_cast<std::streamsize>(stdr::size(bytes)))) return {};
+  return bytes;
+}
+
+static auto current(std::span<const std::byte> bytes) noexcept -> bool {
+  auto in = Reader{ bytes };
+  return in.get<Magic>() == MAGIC and in.get<stk::u32>() == VERSION and in.ok;
+}
+
+auto compiled(const std::filesystem::path& modelfile) noexcept -> std::vector<std::byte> {
+  auto compiledfile = auto{ modelfile }.replace_extension(EXTENSION);
+
+  auto error = std::error_code{};
+  auto source_time   = std::filesystem::last_write_time(modelfile, error);
+  auto compiled_time = std::filesystem::last_write_time(compiledfile, error);
+  if (not error and compiled_time >= source_time) {
+    if (auto bytes = read(compiledfile); current(bytes)) return bytes;
+  }
+
+  auto bytes = encode(parser::Model(parser::document(modelfile)));
+
+  // written aside then renamed over, other processes never read a partly written file
+  auto tmpfile = compiledfile;
+  tmpfile += std::format(".{:x}.tmp", std::random_device{}());
+  {
+    auto out = std::ofstream{ tmpfile, std::ios::binary | std::ios::trunc };
+    out.write(reinterpret_cast<const char*>(stdr::data(bytes)), static_cast<std::streamsize>(stdr::size(bytes)));
+    out.close();
+    error = out ? std::error_code{} : std::make_error_code(std::errc::io_error);
+  }
+  if (not error) std::filesystem::rename(tmpfile, compiledfile, error);
+
+  if (error) {
+    elog("can't write compiled model to {}: {}", compiledfile.string(), error.message());
+    std::filesystem::remove(tmpfile, error);
+  }
+  else {
+    ilog("compiled {} to {}", modelfile.string(), compiledfile.string());
+  }
+
+  return bytes;
+}
+
+auto load(const std::filesystem::path& modelfile) noexcept -> CompiledModel {
+  if (auto model = decode(compiled(modelfile)); model) return std::move(*model);
+
+  elog("can't read compiled {}, parsing it", modelfile.string());
+  return parser::Model(parser::document(modelfile));
+}
+
+}
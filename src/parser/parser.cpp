@@ -4,12 +4,16 @@ import log;
 
 import symmetry;
 
+import engine.analysis;
+
 namespace stk  = stormkit;
 namespace stdr = std::ranges;
 namespace stdv = std::views;
 
 using namespace std::literals;
 
+static constexpr auto DEFAULT_BEAM_WIDTH = 32u;
+
 namespace parser {
 
 constexpr auto is_tag(std::string_view tag) noexcept -> decltype(auto) {
@@ -67,7 +71,7 @@ auto get_charset(const pugi::xml_node& xnode, auto name) -> std::unordered_set<c
   return result;
 }
 
-auto Model(const pugi::xml_document& xmodel) noexcept -> ::Model {
+auto Model(const pugi::xml_document& xmodel) noexcept -> CompiledModel {
   const auto& xnode = xmodel.first_child();
 
   auto symbols = get_string(xnode, "values");
@@ -87,12 +91,16 @@ auto Model(const pugi::xml_document& xmodel) noexcept -> ::Model {
     program = TreeRunner{ TreeRunner::Mode::MARKOV, std::move(nodes) };
   }
 
-  return ::Model{
+  // the grid starts with the first symbol, and the second one if the model has an origin
+  const auto origin = xnode.attribute("origin").as_bool(false);
+  analysis::prune(program, symbols.substr(0, origin ? 2 : 1));
+
+  return CompiledModel{
     // title,
     std::string{ symbols },
     std::move(unions),
-    xnode.attribute("origin").as_bool(false),
-    std::move(program)
+    origin,
+    ::Program{ std::move(program) }
   };
 }
 
@@ -117,7 +125,7 @@ auto NodeRunner(
    or tag == "markov"s
   ) {
     auto mode = tag == "sequence"s ? TreeRunner::Mode::SEQUENCE : TreeRunner::Mode::MARKOV;
-    return { TreeRunner{
+    auto tree = TreeRunner{
       mode,
       {
         std::from_range,
@@ -125,7 +133,11 @@ auto NodeRunner(
           | stdv::filter(std::not_fn(is_tag("union")))
           | stdv::transform(std::bind_back(NodeRunner, unions, symmetry))
       }
-    } };
+    };
+    for (auto&& [k, child] : stdv::enumerate(tree.nodes)) {
+      child.visit([k](auto& node) noexcept { node.order = static_cast<std::size_t>(k); });
+    }
+    return { std::move(tree) };
   }
   if (tag == "one"s
    or tag == "prl"s
@@ -158,8 +170,7 @@ auto RuleNode(
       mode, Rules(xnode, unions, symmetry),
       std::move(unions),
       Observes(xnode),
-      xnode.attribute("limit").as_uint(0),
-      xnode.attribute("depthCoefficient").as_double(0.5)
+      Search(xnode)
     };
   }
 
@@ -219,13 +230,22 @@ auto Rules(
     rules.append_range(stdv::single(xnode) | stdv::transform(std::bind_back(Rule, unions)));
   }
   
-  return {
+  auto expanded = std::vector<RewriteRule>{
     std::from_range,
     std::move(rules)
      | stdv::transform(std::bind_back(symmetries<RewriteRule>, symmetry))
      | stdv::join
-     | stdv::as_rvalue
+     // once the symmetries are known, they transform the full rule
+     | stdv::transform(&RewriteRule::trimmed)
   };
+
+  stk::ensures(
+    stdr::size(expanded) <= std::numeric_limits<stk::u16>::max(),
+    std::format("too many rules in '{}' node once symmetries are applied ({}) [:{}]",
+                xnode.name(), stdr::size(expanded), xnode.offset_debug())
+  );
+
+  return expanded;
 }
 
 auto Field(const pugi::xml_node& xnode) noexcept -> std::pair<char, ::Field> {
@@ -279,6 +299,26 @@ auto Observes(const pugi::xml_node& xnode) noexcept -> ::Observes {
   return { std::from_range, xnode.children("observe") | stdv::transform(Observe) };
 }
 
+auto Search(const pugi::xml_node& xnode) noexcept -> ::Search {
+  auto strategy = std::string_view{ xnode.attribute("strategy").as_string("best") };
+
+  stk::ensures(
+    strategy == "best" or strategy == "beam" or strategy == "ida",
+    std::format("attribute '{}' of '{}' node must be one of 'best', 'beam' or 'ida' [:{}]",
+                "strategy", xnode.name(), xnode.offset_debug())
+  );
+
+  return ::Search{
+    .strategy = strategy == "beam" ? ::Search::Strategy::BEAM
+              : strategy == "ida"  ? ::Search::Strategy::IDA
+              :                      ::Search::Strategy::BEST_FIRST,
+    .limit = xnode.attribute("limit").as_uint(0),
+    .width = xnode.attribute("width").as_uint(DEFAULT_BEAM_WIDTH),
+    .depthCoefficient = xnode.attribute("depthCoefficient").as_double(0.5),
+    .canonical = xnode.attribute("canonical").as_bool(false),
+  };
+}
+
 auto Palette(const pugi::xml_document& xpalette) noexcept -> ColorPalette {
   return {
     std::from_range,
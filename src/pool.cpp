@@ -0,0 +1,81 @@
+module pool;
+
+namespace stdr = std::ranges;
+namespace stdv = std::views;
+
+Pool::Pool(std::size_t size) noexcept
+: queues(std::max(size, 1uz))
+{
+  workers.reserve(stdr::size(queues));
+  for (auto self : stdv::iota(0uz, stdr::size(queues))) {
+    workers.emplace_back(std::bind_front(&Pool::work, this), self);
+  }
+}
+
+auto Pool::size() const noexcept -> std::size_t {
+  return stdr::size(queues);
+}
+
+auto Pool::submit(Task&& task) noexcept -> void {
+  // counted before it can be taken, so the counters never go below the tasks actually left
+  {
+    auto lock = std::scoped_lock{ mutex };
+    ++pending;
+    ++queued;
+  }
+  auto& queue = queues[next.fetch_add(1, std::memory_order_relaxed) % stdr::size(queues)];
+  {
+    auto lock = std::scoped_lock{ queue.mutex };
+    queue.tasks.push_back(std::move(task));
+  }
+  available.notify_one();
+}
+
+auto Pool::wait() noexcept -> void {
+  auto lock = std::unique_lock{ mutex };
+  idle.wait(lock, [this] noexcept { return pending.load() == 0; });
+}
+
+auto Pool::take(std::size_t self) noexcept -> std::optional<Task> {
+  // own queue from the back, most recently submitted first
+  {
+    auto& queue = queues[self];
+    auto lock = std::scoped_lock{ queue.mutex };
+    if (not stdr::empty(queue.tasks)) {
+      auto task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      --queued;
+      return task;
+    }
+  }
+
+  // others from the front, oldest first
+  for (auto i : stdv::iota(1uz, stdr::size(queues))) {
+    auto& queue = queues[(self + i) % stdr::size(queues)];
+    auto lock = std::scoped_lock{ queue.mutex };
+    if (not stdr::empty(queue.tasks)) {
+      auto task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      --queued;
+      return task;
+    }
+  }
+
+  return std::nullopt;
+}
+
+auto Pool::work(std::stop_token stop, std::size_t self) noexcept -> void {
+  while (not stop.stop_requested()) {
+    if (auto task = take(self); task) {
+      (*task)();
+      if (pending.fetch_sub(1) == 1) {
+        auto lock = std::scoped_lock{ mutex };
+        idle.notify_all();
+      }
+      continue;
+    }
+
+    auto lock = std::unique_lock{ mutex };
+    available.wait(lock, stop, [this] noexcept { return queued.load() > 0; });
+  }
+}
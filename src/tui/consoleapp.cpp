@@ -9,11 +9,14 @@ import geometry;
 import engine.model;
 import engine.rulenode;
 import parser;
+import parser.binary;
 import controls;
+import config;
 
 import ftxui;
 import tui.render;
 
+namespace stk  = stormkit;
 namespace stdr = std::ranges;
 namespace stdv = std::views;
 
@@ -22,24 +25,21 @@ using namespace std::string_literals;
 using clk = std::chrono::high_resolution_clock;
 
 static const auto DEFAULT_PALETTE_FILE = "resources/palette.xml"s;
-static const auto DEFAULT_MODEL_FILE   = "models/GoToGradient.xml"s;
 
-static constexpr auto DEFAULT_GRID_EXTENT = std::dims<3>{1u, 59u, 59u};
 static constexpr auto DEFAULT_TICKRATE = 60;
 
 auto ConsoleApp::operator()(std::span<const std::string_view> args) noexcept -> int {
   auto palettefile = DEFAULT_PALETTE_FILE;
   auto default_palette = parser::Palette(parser::document(palettefile));
 
-  auto modelarg = stdr::find_if(args, [](const auto& arg) static noexcept {
-    return stdr::cbegin(stdr::search(arg, "models/"s)) == stdr::cbegin(arg);
-  });
-  auto modelfile =
-    modelarg != stdr::end(args) ? std::string{ *modelarg }
-                                : DEFAULT_MODEL_FILE;
+  auto config = Config::parse(args);
 
-  auto model = parser::Model(parser::document(modelfile));
-  auto palette = model.symbols
+  // the compiled model skips xml parsing and symmetry expansion
+  auto model = ModelInstance{ std::make_shared<const CompiledModel>(
+    flag(args, "compiled") ? parser::binary::load(config.modelfile)
+                           : parser::Model(parser::document(config.modelfile))
+  ) };
+  auto palette = model.compiled->symbols
     | stdv::transform([&default_palette](auto character) noexcept {
         if (not default_palette.contains(character)) {
           return std::tuple{ character, Color{ Color::Default }};
@@ -49,35 +49,51 @@ auto ConsoleApp::operator()(std::span<const std::string_view> args) noexcept ->
     })
     | stdr::to<render::Palette>();
 
-  auto extent = DEFAULT_GRID_EXTENT;
-  auto grid = TracedGrid{ extent, model.symbols[0] };
-  if (model.origin) grid[grid.area().center()] = model.symbols[1];
+  // without a given seed every reset draws a new one
+  auto seed = config.seed.value_or(std::random_device{}());
+  ilog("seed {}", seed);
+  model.program.seed(seed);
+  auto grid = model.grid(config.extents);
 
   auto controls = Controls {
     .tickrate = DEFAULT_TICKRATE,
-    .onReset = [&grid, &model]{
-      reset(model.program);
-      grid = { grid.extents, model.symbols[0] };
-      if (model.origin) grid[grid.area().center()] = model.symbols[1];
+    .onReset = [&grid, &model, fixed = config.seed.has_value()]{
+      model.program.reset();
+      if (not fixed) {
+        auto seed = std::random_device{}();
+        ilog("seed {}", seed);
+        model.program.seed(seed);
+      }
+      grid = model.grid(grid.extents);
     },
   };
 
-  auto program_thread = std::jthread{ [&grid, &model, &controls](std::stop_token stop) mutable noexcept {
-    auto last_time = clk::now();
-    // swap the two next lines
-    for (auto _ : model.program.visit([&grid](auto& f) noexcept { return f(grid); })) {
-      animation::RequestAnimationFrame();
-
-      if (stop.stop_requested()) break;
-
-      controls.rate_limit(last_time);
-      controls.wait_unpause();
+  auto program_thread = std::jthread{ [&grid, &model, &controls, maxsteps = config.steps](std::stop_token stop) mutable noexcept {
+    auto last_time  = clk::now();
+    auto steps      = stk::u64{ 0 };
+    auto generation = controls.generation.load();
+    while (not stop.stop_requested()) {
+      // a reset starts the count over and runs a halted program again
+      if (auto g = controls.generation.load(); g != generation) {
+        generation   = g;
+        steps        = 0;
+        model.halted = false;
+      }
+
+      if (not model.halted) {
+        auto status = model.program.step(grid);
+        if (status == ProgramState::Status::STEP) ++steps;
+        model.halted = status == ProgramState::Status::HALT or (maxsteps != 0 and steps == maxsteps);
+        animation::RequestAnimationFrame();
+      }
+
+      // the thread stays up once halted, waiting for a reset
+      if (model.halted) controls.pause();
+      else controls.rate_limit(last_time);
+      controls.wait_unpause(stop);
 
       last_time = clk::now();
     }
-
-    model.halted = true;
-    animation::RequestAnimationFrame(); 
   } };
 
   auto view = render::MainView(grid, model, controls, palette);
@@ -31,19 +31,21 @@ Element grid(const ::TracedGrid<char>& g, const Palette& palette) noexcept {
     static_cast<int>(g.extents.extent(2)) * 2,
     static_cast<int>(g.extents.extent(1))
   };
+  const auto area = g.area();
   stdr::for_each(
-    stdv::zip(mdiota(g.area()), g),
-    [&](auto u_char) noexcept {
-      auto [u, character] = u_char;
-      
-      auto b = palette.contains(character) ? palette.at(character)
-                                           : Color::Default;
-      auto& pixel0 = texture.PixelAt(u.x * 2, u.y);
-      pixel0.character        = ' ';
-      pixel0.background_color = b;
-      auto& pixel1 = texture.PixelAt(u.x * 2 + 1, u.y);
-      pixel1.character        = ' ';
-      pixel1.background_color = b;
+    stdv::zip(mdiota(Area3{ area.u, { 1u, area.size.y, area.size.z } }), g.rows(area)),
+    [&](auto u_row) noexcept {
+      auto [u, row] = u_row;
+      for (auto x = 0; x < static_cast<int>(stdr::size(row)); ++x) {
+        auto b = palette.contains(row[x]) ? palette.at(row[x])
+                                          : Color::Default;
+        auto& pixel0 = texture.PixelAt(x * 2, u.y);
+        pixel0.character        = ' ';
+        pixel0.background_color = b;
+        auto& pixel1 = texture.PixelAt(x * 2 + 1, u.y);
+        pixel1.character        = ' ';
+        pixel1.background_color = b;
+      }
     }
   );
   auto w = texture.dimx(), h = texture.dimy();
@@ -172,21 +174,24 @@ Element potential(char c, const Potential& pot, const Palette& palette) noexcept
   );
 }
 
-Element ruleRunner(const RuleRunner& node, const Palette& palette) noexcept {
-  auto tag = node.rulenode.mode == RuleNode::Mode::ONE ? "one"
-           : node.rulenode.mode == RuleNode::Mode::ALL ? "all"
-                                                       : "prl";
+Element ruleRunner(const ProgramState& state, std::size_t index, const Palette& palette) noexcept {
+  const auto& node     = state.program->nodes[index];
+  const auto& rulenode = state.program->rules[node.rule];
+
+  auto tag = rulenode.mode == RuleNode::Mode::ONE ? "one"
+           : rulenode.mode == RuleNode::Mode::ALL ? "all"
+                                                  : "prl";
 
   auto steps = node.steps != 0 ? std::format("{}", node.steps)
                                : std::string{ "∞" };
 
   auto elements = Elements{};
   for(
-    auto irule = stdr::cbegin(node.rulenode.rules);
-    irule != stdr::cend(node.rulenode.rules);
+    auto irule = stdr::cbegin(rulenode.rules);
+    irule != stdr::cend(rulenode.rules);
   ) {
     auto next_rule = stdr::find_if(
-      irule + 1, stdr::cend(node.rulenode.rules),
+      irule + 1, stdr::cend(rulenode.rules),
       std::not_fn(&RewriteRule::is_copy)
     );
     elements.push_back(hbox({
@@ -196,40 +201,46 @@ Element ruleRunner(const RuleRunner& node, const Palette& palette) noexcept {
     irule = next_rule;
   }
 
+  auto header = text(std::format("{} ({}/{})", tag, state.nodes[index].step, steps));
+  if (const auto* progress = state.rules[node.rule].searching(); progress != nullptr) {
+    header = hbox({
+      header,
+      text(std::format(" searching {} states, best {:.1f}",
+        progress->expanded.load(std::memory_order_relaxed),
+        progress->best.load(std::memory_order_relaxed)
+      )) | dim,
+    });
+  }
+
   return vbox({
-    text(std::format("{} ({}/{})", tag, node.step, steps)),
+    header,
     hbox({ separator(), vbox(elements) })
   });
 }
 
-Element treeRunner(const TreeRunner& node, const Palette& palette, bool selected) noexcept {
-  auto tag = node.mode == TreeRunner::Mode::SEQUENCE ? "sequence"
-                                                     : "markov";
+Element treeRunner(const ProgramState& state, std::size_t index, const Palette& palette) noexcept {
+  const auto& program = *state.program;
+  auto tag = program.nodes[index].kind == Program::Node::Kind::SEQUENCE ? "sequence"
+                                                                        : "markov";
 
-  auto elements = stdv::zip(node.nodes, stdv::iota(stk::ioffset{ 0 }))
-    | stdv::transform([&palette, &selected, current_index = node.current_index()](const auto& ni) noexcept {
-        const auto& [n, i] = ni;
-        return nodeRunner(n, palette, selected and current_index == i);
-      })
-    | stdr::to<Elements>();
+  auto elements = Elements{};
+  for (auto child = program.first(index);
+            child != Program::NONE;
+            child = program.nodes[child].next
+  ) {
+    elements.push_back(nodeRunner(state, child, palette));
+  }
 
   auto element = vbox({ text(tag), hbox({ separator(), vbox(elements) }) });
   // if (selected) element |= focus;
   return element;
 }
 
-Element nodeRunner(const NodeRunner& node, const Palette& palette, bool selected) noexcept {
-  Element e;
-  if (const auto& t = std::get_if<TreeRunner>(&node); t != nullptr) {
-    e = treeRunner(*t, palette, selected);
-  }
-  else if (const auto& r = std::get_if<RuleRunner>(&node); r != nullptr) {
-    e = ruleRunner(*r, palette);
-  }
-  else {
-    e = text("<unknown_node_runner>");
-  }
-  if (selected) e |= focus;
+Element nodeRunner(const ProgramState& state, std::size_t index, const Palette& palette) noexcept {
+  auto e = state.program->nodes[index].kind == Program::Node::Kind::RULE
+    ? ruleRunner(state, index, palette)
+    : treeRunner(state, index, palette);
+  if (state.active(index)) e |= focus;
   return e;
 }
 
@@ -254,15 +265,15 @@ Element symbols(std::string_view values, const Palette& palette) noexcept {
       | size(HEIGHT, EQUAL, h);
 }
 
-Element model(const ::Model& model, const Palette& palette) noexcept {
+Element model(const ModelInstance& model, const Palette& palette) noexcept {
   return vbox({
     window(
       text("symbols"),
-      symbols(model.symbols, palette)
+      symbols(model.compiled->symbols, palette)
     ),
     window(
       text(model.halted ? "program (H)" : "program"),
-      nodeRunner(model.program, palette)
+      nodeRunner(model.program, 0, palette)
         | vscroll_indicator | frame
     ),
   });
@@ -301,10 +312,10 @@ struct GridScroll {
   T y;
 };
 
-Component WorldAndPotentials(const TracedGrid<char>& grid, const Model& model, const render::Palette& palette) {
+Component WorldAndPotentials(const TracedGrid<char>& grid, const ModelInstance& model, const render::Palette& palette) {
   struct Impl : ComponentBase {
-    const Model& model;
-    const RuleNode* node = nullptr;
+    const ModelInstance& model;
+    const RuleState* node = nullptr;
 
     std::vector<std::string> tabnames = {};
     int tabselect = 0;
@@ -312,7 +323,7 @@ Component WorldAndPotentials(const TracedGrid<char>& grid, const Model& model, c
     Component tabview;
     GridScroll<int> grid_scroll = { 0, 0 };
 
-    Impl(const TracedGrid<char>& grid, const Model& _model, const render::Palette& palette)
+    Impl(const TracedGrid<char>& grid, const ModelInstance& _model, const render::Palette& palette)
     : model{ _model },
       tabnames{ { "World" } },
       tabtoggle{ Toggle(&tabnames, &tabselect) },
@@ -336,7 +347,7 @@ Component WorldAndPotentials(const TracedGrid<char>& grid, const Model& model, c
     }
 
     void RefreshPotentials() {
-      auto r = current(model.program);
+      auto r = model.program.current();
 
       if ((node == nullptr and r == nullptr)
        or (node == r and stdr::equal(
@@ -381,7 +392,7 @@ Component WorldAndPotentials(const TracedGrid<char>& grid, const Model& model, c
   return Make<Impl>(grid, model, palette);
 }
 
-Component MainView(const TracedGrid<char>& grid, const Model& model, Controls& controls, const Palette& palette) {
+Component MainView(const TracedGrid<char>& grid, const ModelInstance& model, Controls& controls, const Palette& palette) {
   return Container::Horizontal({
     Container::Vertical({
       Renderer([]{
@@ -389,11 +400,11 @@ Component MainView(const TracedGrid<char>& grid, const Model& model, Controls& c
           | hcenter | border | xflex_grow;
       }),
       Renderer([&model, &palette]{
-        return symbols(model.symbols, palette)
+        return symbols(model.compiled->symbols, palette)
           | window_wrap("symbols");
       }),
       Renderer([&model, &palette]{
-        return nodeRunner(model.program, palette)
+        return nodeRunner(model.program, 0, palette)
           | vscroll_indicator
           | yframe
           | window_wrap("program");